@@ -0,0 +1,489 @@
+/**
+ *  @file  benchbuddy.c
+ *
+ *  @note  Microbenchmarks for the allocator
+ *
+ *  @note
+ *    Each workload runs against one or more allocators (the buddy heap, the buddy
+ *    heap with sized free and the C library malloc). Every operation is timed with
+ *    a monotonic clock and the latency percentiles and throughput of alloc and
+ *    free are reported, one line per allocator, workload and operation.
+ *
+ *  Workload |  Description
+ *  ---------|-------------------------------------------------------------------
+ *  lifo     |  allocates a batch of blocks and frees them in reverse order
+ *  fifo     |  allocates a batch of blocks and frees them in the same order
+ *  random   |  random alloc/free with sizes uniform up to the maximal size
+ *  powerlaw |  random alloc/free with sizes following a power law
+ *  churn    |  fills the heap up to the occupancy, then frees and allocates a
+ *           |  random block at each step (steady state)
+ *
+ *  Usage: benchbuddy [-w workload] [-a allocator] [-p policy] [-n ops] [-o occupancy%]
+ *                    [-s heapsize] [-m minsize] [-x maxsize] [-r seed] [-j]
+ *
+ *  The output is CSV, or JSON with -j.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buddy.h"
+
+/**
+ *  @brief  Default parameters
+ */
+///@{
+#define HEAPSIZE    (64*1024*1024)
+#define MINSIZE     64
+#define MAXSIZE     4096
+#define NOPS        200000
+#define OCCUPANCY   70
+#define BATCH       1024
+///@}
+
+/**
+ *  @brief  Allocator under test
+ */
+typedef struct {
+    const char *name;
+    void      *(*alloc)(size_t size);
+    void       (*free)(void *p, size_t size);
+} allocator;
+
+/**
+ *  @brief  Samples of an operation
+ */
+typedef struct {
+    uint32_t   *ns;                 ///< latency of each operation
+    long        count;
+    double      total;              ///< total time in ns
+} samples;
+
+static buddy_heap heap;
+static char *heaparea;
+static void *heapmetadata;
+
+static size_t heapsize = HEAPSIZE;
+static size_t minsize = MINSIZE;
+static size_t maxsize = MAXSIZE;
+static long nops = NOPS;
+static int occupancy = OCCUPANCY;
+static int json = 0;
+static int nlines = 0;
+
+/**
+ *  @brief  Allocators
+ */
+///@{
+static void *heapalloc(size_t size) { return buddy_heap_alloc(&heap,size); }
+static void  heapfree(void *p, size_t size) { (void) size; buddy_heap_free(&heap,p); }
+static void  heapfreesized(void *p, size_t size) { buddy_heap_free_sized(&heap,p,size); }
+static void *libcalloc(size_t size) { return malloc(size); }
+static void  libcfree(void *p, size_t size) { (void) size; free(p); }
+
+static allocator allocators[] = {
+    { "buddy",       heapalloc,  heapfree       },
+    { "buddy_sized", heapalloc,  heapfreesized  },
+    { "malloc",      libcalloc,  libcfree       },
+};
+#define NALLOCATORS ((int) (sizeof(allocators)/sizeof(allocators[0])))
+///@}
+
+/**
+ *  @brief  Placement policies (-p)
+ */
+static const char *policies[] = { "firstfit", "bestfit", "address", "topdown" };
+#define NPOLICIES   ((int) (sizeof(policies)/sizeof(policies[0])))
+static int policy = BUDDY_POLICY_FIRSTFIT;
+
+/**
+ *  @brief  Random numbers (xorshift64*), reproducible among runs
+ */
+///@{
+static uint64_t rngseed = 88172645463325252ULL;
+static uint64_t rngstate;
+
+static uint64_t
+rng(void) {
+    rngstate ^= rngstate>>12;
+    rngstate ^= rngstate<<25;
+    rngstate ^= rngstate>>27;
+    return rngstate*2685821657736338717ULL;
+}
+
+/// Uniform in [0,1[
+static double
+rnguniform(void) {
+    return (rng()>>11)*(1.0/9007199254740992.0);
+}
+
+/// Uniform in [1,maxsize]
+static size_t
+sizeuniform(void) {
+    return 1+rng()%maxsize;
+}
+
+/// Power law (Pareto with alpha = 1.2) from minsize/16 up to maxsize
+static size_t
+sizepowerlaw(void) {
+double x;
+size_t s;
+
+    x = (minsize/16.0+1)/pow(1.0-rnguniform(),1.0/1.2);
+    s = x > maxsize ? maxsize : (size_t) x;
+    return s ? s : 1;
+}
+///@}
+
+/**
+ *  @brief  now
+ *
+ *  @note   returns a monotonic time in nanoseconds
+ */
+static inline uint64_t
+now(void) {
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t) ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/**
+ *  @brief  Timed operations
+ */
+///@{
+static inline void *
+timedalloc(allocator *a, size_t size, samples *s) {
+uint64_t t0,t1;
+void *p;
+
+    t0 = now();
+    p = a->alloc(size);
+    t1 = now();
+    s->ns[s->count++] = (uint32_t) (t1-t0);
+    s->total += (double) (t1-t0);
+    return p;
+}
+
+static inline void
+timedfree(allocator *a, void *p, size_t size, samples *s) {
+uint64_t t0,t1;
+
+    t0 = now();
+    a->free(p,size);
+    t1 = now();
+    s->ns[s->count++] = (uint32_t) (t1-t0);
+    s->total += (double) (t1-t0);
+}
+///@}
+
+/**
+ *  @brief  Live blocks of a workload
+ */
+///@{
+static void **blocks;
+static size_t *sizes;
+static long nblocks;
+static long maxblocks;
+///@}
+
+/**
+ *  @brief  Workloads
+ *
+ *  @note   Each one does about nops allocations (and as many frees) and leaves
+ *          no block allocated. The blocks left at the end of random, powerlaw
+ *          and churn are freed without measuring the frees.
+ */
+///@{
+static void
+batch(allocator *a, samples *sa, samples *sf, int lifo) {
+long n,i,done;
+
+    done = 0;
+    while( done < nops ) {
+        n = 0;
+        while( (n < BATCH) && (done < nops) ) {
+            sizes[n] = sizeuniform();
+            blocks[n] = timedalloc(a,sizes[n],sa);
+            done++;
+            if( blocks[n] == 0 )
+                break;
+            n++;
+        }
+        for(i=0;i<n;i++) {
+            if( lifo )
+                timedfree(a,blocks[n-1-i],sizes[n-1-i],sf);
+            else
+                timedfree(a,blocks[i],sizes[i],sf);
+        }
+    }
+}
+
+static void lifo(allocator *a, samples *sa, samples *sf) { batch(a,sa,sf,1); }
+static void fifo(allocator *a, samples *sa, samples *sf) { batch(a,sa,sf,0); }
+
+static void
+mixed(allocator *a, samples *sa, samples *sf, size_t (*sizefunc)(void)) {
+long done,i;
+void *p;
+size_t s;
+
+    nblocks = 0;
+    done = 0;
+    while( done < nops ) {
+        if( (nblocks > 0) && ((nblocks == maxblocks) || (rng()&1)) ) {
+            i = rng()%nblocks;
+            timedfree(a,blocks[i],sizes[i],sf);
+            nblocks--;
+            blocks[i] = blocks[nblocks];
+            sizes[i] = sizes[nblocks];
+        } else {
+            s = sizefunc();
+            p = timedalloc(a,s,sa);
+            done++;
+            if( p ) {
+                blocks[nblocks] = p;
+                sizes[nblocks] = s;
+                nblocks++;
+            }
+        }
+    }
+    // Drain (not measured)
+    while( nblocks > 0 ) {
+        nblocks--;
+        a->free(blocks[nblocks],sizes[nblocks]);
+    }
+}
+
+static void uniformmix(allocator *a, samples *sa, samples *sf) { mixed(a,sa,sf,sizeuniform); }
+static void powerlawmix(allocator *a, samples *sa, samples *sf) { mixed(a,sa,sf,sizepowerlaw); }
+
+static void
+churn(allocator *a, samples *sa, samples *sf) {
+size_t target,inuse;
+long done,i;
+void *p;
+samples dummy;
+
+    // Fill (not measured)
+    dummy.ns = sa->ns;
+    dummy.total = 0;
+    target = heapsize/100*occupancy;
+    inuse = 0;
+    nblocks = 0;
+    while( (inuse < target) && (nblocks < maxblocks) ) {
+        dummy.count = 0;
+        sizes[nblocks] = sizepowerlaw();
+        p = timedalloc(a,sizes[nblocks],&dummy);
+        if( p == 0 )
+            break;
+        blocks[nblocks] = p;
+        inuse += sizes[nblocks];
+        nblocks++;
+    }
+    // Steady state
+    done = 0;
+    while( (done < nops) && (nblocks > 0) ) {
+        i = rng()%nblocks;
+        timedfree(a,blocks[i],sizes[i],sf);
+        sizes[i] = sizepowerlaw();
+        p = timedalloc(a,sizes[i],sa);
+        done++;
+        if( p ) {
+            blocks[i] = p;
+        } else {
+            nblocks--;
+            blocks[i] = blocks[nblocks];
+            sizes[i] = sizes[nblocks];
+        }
+    }
+    // Drain (not measured)
+    while( nblocks > 0 ) {
+        nblocks--;
+        a->free(blocks[nblocks],sizes[nblocks]);
+    }
+}
+///@}
+
+/**
+ *  @brief  Workload table
+ */
+///@{
+typedef struct {
+    const char *name;
+    void      (*run)(allocator *a, samples *sa, samples *sf);
+} workload;
+
+static workload workloads[] = {
+    { "lifo",      lifo        },
+    { "fifo",      fifo        },
+    { "random",    uniformmix  },
+    { "powerlaw",  powerlawmix },
+    { "churn",     churn       },
+};
+#define NWORKLOADS ((int) (sizeof(workloads)/sizeof(workloads[0])))
+///@}
+
+/**
+ *  @brief  compare32
+ */
+static int
+compare32(const void *a, const void *b) {
+uint32_t x = *(const uint32_t *) a;
+uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  percentile
+ *
+ *  @note   samples must be sorted. p in per thousand
+ */
+static uint32_t
+percentile(samples *s, int p) {
+long i;
+
+    if( s->count == 0 )
+        return 0;
+    i = (s->count*p)/1000;
+    if( i >= s->count )
+        i = s->count-1;
+    return s->ns[i];
+}
+
+/**
+ *  @brief  report
+ */
+static void
+report(const char *alloc, const char *work, const char *op, samples *s) {
+double opspersec;
+
+    qsort(s->ns,s->count,sizeof(uint32_t),compare32);
+    opspersec = s->total > 0 ? s->count*1e9/s->total : 0;
+    if( json ) {
+        printf("%s  {\"allocator\": \"%s\", \"workload\": \"%s\", \"op\": \"%s\", "
+               "\"count\": %ld, \"ops_per_sec\": %.0f, \"p50_ns\": %u, "
+               "\"p99_ns\": %u, \"p999_ns\": %u, \"max_ns\": %u}",
+               nlines ? ",\n" : "",alloc,work,op,s->count,opspersec,
+               percentile(s,500),percentile(s,990),percentile(s,999),
+               s->count ? s->ns[s->count-1] : 0);
+    } else {
+        printf("%s,%s,%s,%ld,%.0f,%u,%u,%u,%u\n",alloc,work,op,s->count,opspersec,
+               percentile(s,500),percentile(s,990),percentile(s,999),
+               s->count ? s->ns[s->count-1] : 0);
+    }
+    nlines++;
+}
+
+/**
+ *  @brief  usage
+ */
+static void
+usage(const char *prog) {
+int i;
+
+    fprintf(stderr,"Usage: %s [-w workload] [-a allocator] [-p policy] [-n ops] [-o occupancy%%]\n"
+                   "          [-s heapsize] [-m minsize] [-x maxsize] [-r seed] [-j]\n",prog);
+    fprintf(stderr,"Workloads:");
+    for(i=0;i<NWORKLOADS;i++)
+        fprintf(stderr," %s",workloads[i].name);
+    fprintf(stderr,"\nAllocators:");
+    for(i=0;i<NALLOCATORS;i++)
+        fprintf(stderr," %s",allocators[i].name);
+    fprintf(stderr,"\nPolicies:");
+    for(i=0;i<NPOLICIES;i++)
+        fprintf(stderr," %s",policies[i]);
+    fprintf(stderr,"\n");
+}
+
+/**
+ *  @brief  benchmark program
+ */
+int
+main(int argc, char *argv[])
+{
+const char *wname = 0;
+const char *aname = 0;
+const char *pname = 0;
+samples sa,sf;
+int opt,i,j;
+
+    while( (opt = getopt(argc,argv,"w:a:p:n:o:s:m:x:r:jh")) != -1 ) {
+        switch(opt) {
+        case 'w': wname = optarg;                       break;
+        case 'a': aname = optarg;                       break;
+        case 'p': pname = optarg;                       break;
+        case 'n': nops = atol(optarg);                  break;
+        case 'o': occupancy = atoi(optarg);             break;
+        case 's': heapsize = strtoul(optarg,0,0);       break;
+        case 'm': minsize = strtoul(optarg,0,0);        break;
+        case 'x': maxsize = strtoul(optarg,0,0);        break;
+        case 'r': rngseed = strtoull(optarg,0,0)|1;     break;
+        case 'j': json = 1;                             break;
+        default:  usage(argv[0]);                       return 1;
+        }
+    }
+
+    for(i=0;pname && (i<NPOLICIES);i++) {
+        if( strcmp(pname,policies[i]) == 0 )
+            break;
+    }
+    if( i == NPOLICIES ) {
+        usage(argv[0]);
+        return 1;
+    }
+    if( pname )
+        policy = i;
+
+    heaparea = malloc(heapsize);
+    // Page faults out of the runs (BUDDY_CHECKED writes to the blocks)
+    memset(heaparea,0,heapsize);
+    heapmetadata = malloc(BUDDY_METADATASIZE(heapsize,minsize));
+    maxblocks = heapsize/minsize;
+    blocks = malloc(maxblocks*sizeof(void *));
+    sizes = malloc(maxblocks*sizeof(size_t));
+    // Each workload does at most nops allocations and frees
+    sa.ns = malloc((nops+maxblocks)*sizeof(uint32_t));
+    sf.ns = malloc((nops+maxblocks)*sizeof(uint32_t));
+    if( !heaparea || !heapmetadata || !blocks || !sizes || !sa.ns || !sf.ns ) {
+        fprintf(stderr,"Not enough memory\n");
+        return 1;
+    }
+    if( buddy_heap_init(&heap,heaparea,heapsize,minsize,heapmetadata) ) {
+        fprintf(stderr,"Minimal size must be a power of 2 not larger than the heap\n");
+        return 1;
+    }
+
+    if( json )
+        printf("[\n");
+    else
+        printf("allocator,workload,op,count,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+    for(i=0;i<NWORKLOADS;i++) {
+        if( wname && strcmp(wname,workloads[i].name) )
+            continue;
+        for(j=0;j<NALLOCATORS;j++) {
+            if( aname && strcmp(aname,allocators[j].name) )
+                continue;
+            buddy_heap_init(&heap,heaparea,heapsize,minsize,heapmetadata);
+            buddy_heap_setpolicy(&heap,policy);
+            // Same sequence for all allocators
+            rngstate = rngseed;
+            sa.count = sf.count = 0;
+            sa.total = sf.total = 0;
+            workloads[i].run(&allocators[j],&sa,&sf);
+            report(allocators[j].name,workloads[i].name,"alloc",&sa);
+            report(allocators[j].name,workloads[i].name,"free",&sf);
+        }
+    }
+    if( json )
+        printf("\n]\n");
+    return 0;
+}
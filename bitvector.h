@@ -12,6 +12,7 @@
 
 #ifdef DEBUG
 #include <stdio.h>
+#include <inttypes.h>
 #endif
 
 /**
@@ -19,22 +20,144 @@
  *          its size and how to get the index part (which element) and bit
  *          part (which bit).
  *
- *  @note   When changing theses symbols, the format specifier in bv_dump
- *          must be adjusted.
+ *  @note   They are selected by BV_WIDTH, that can be 32 (default) or 64.
  */
 ///@{
+#ifndef BV_WIDTH
+#define BV_WIDTH    32
+#endif
+#if BV_WIDTH == 64
 /// Type used to store the bit vector
-#define BV_TYPE     uint32_t
+#define BV_TYPE     uint64_t
 /// Number of bits in the type BV_TYPE
+#define BV_BITS     (64)
+/// Constante One according type
+#define BV_ONE      (1ULL)
+/// This is a divide by BV_BITS using shifts
+#define BV_SHIFT    6
+/// The rest of division by BV_BITS
+#define BV_BITMASK  0x3F
+/// Format used by bv_dump
+#define BV_FORMAT   "%016" PRIX64
+#elif BV_WIDTH == 32
+#define BV_TYPE     uint32_t
 #define BV_BITS     (32)
-/// Constante One according type. When using long. use 1UL
 #define BV_ONE      (1U)
-/// This is a divide by BV_BITS using shifts
 #define BV_SHIFT    5
-/// The rest of division by BV_BITS
 #define BV_BITMASK  0x1F
+#define BV_FORMAT   "%08" PRIX32
+#else
+#error "BV_WIDTH must be 32 or 64"
+#endif
+/// Element with all bits set
+#define BV_ALLONES  (~(BV_TYPE) 0)
 ///@}
 
+/**
+ *  @brief  Wide (SIMD) access to the bit vectors
+ *
+ *  @note   When BV_SIMD is defined, the routines that work on many elements
+ *          (bv_setall, bv_clearall, bv_setrange, bv_clearrange and the searches)
+ *          load and store a chunk of BV_CHUNKBYTES bytes at once, using AVX2,
+ *          SSE2 or NEON, according to the target. Elements are accessed with
+ *          unaligned loads/stores, so bit vectors need no special alignment.
+ */
+///@{
+#ifdef BV_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BV_CHUNKBYTES   32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BV_CHUNKBYTES   16
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BV_CHUNKBYTES   16
+#else
+#undef BV_SIMD
+#endif
+#endif
+
+#ifdef BV_SIMD
+/// Number of elements in a chunk
+#define BV_CHUNK        ((int) (BV_CHUNKBYTES/sizeof(BV_TYPE)))
+
+/**
+ *  @brief  bv_chunkzero
+ *
+ *  @note   returns a non zero value if all bits of a chunk starting at p are cleared
+ */
+static inline int
+bv_chunkzero(const BV_TYPE *p) {
+#if defined(__AVX2__)
+__m256i x = _mm256_loadu_si256((const __m256i *) p);
+    return _mm256_testz_si256(x,x);
+#elif defined(__SSE2__)
+__m128i x = _mm_loadu_si128((const __m128i *) p);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x,_mm_setzero_si128())) == 0xFFFF;
+#else
+uint32x4_t x = vld1q_u32((const uint32_t *) p);
+    return (vgetq_lane_u64(vreinterpretq_u64_u32(x),0)|vgetq_lane_u64(vreinterpretq_u64_u32(x),1)) == 0;
+#endif
+}
+
+/**
+ *  @brief  bv_chunkones
+ *
+ *  @note   returns a non zero value if all bits of a chunk starting at p are set
+ */
+static inline int
+bv_chunkones(const BV_TYPE *p) {
+#if defined(__AVX2__)
+__m256i x = _mm256_loadu_si256((const __m256i *) p);
+    return _mm256_testc_si256(x,_mm256_set1_epi32(-1));
+#elif defined(__SSE2__)
+__m128i x = _mm_loadu_si128((const __m128i *) p);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x,_mm_set1_epi32(-1))) == 0xFFFF;
+#else
+uint32x4_t x = vld1q_u32((const uint32_t *) p);
+    return (vgetq_lane_u64(vreinterpretq_u64_u32(x),0)&vgetq_lane_u64(vreinterpretq_u64_u32(x),1)) == ~(uint64_t) 0;
+#endif
+}
+
+/**
+ *  @brief  bv_chunkfill
+ *
+ *  @note   writes a chunk starting at p with all bits set (ones != 0) or cleared
+ */
+static inline void
+bv_chunkfill(BV_TYPE *p, int ones) {
+#if defined(__AVX2__)
+    _mm256_storeu_si256((__m256i *) p,ones ? _mm256_set1_epi32(-1) : _mm256_setzero_si256());
+#elif defined(__SSE2__)
+    _mm_storeu_si128((__m128i *) p,ones ? _mm_set1_epi32(-1) : _mm_setzero_si128());
+#else
+    vst1q_u32((uint32_t *) p,vdupq_n_u32(ones ? 0xFFFFFFFF : 0));
+#endif
+}
+#endif
+///@}
+
+/**
+ *  @brief  bv_fill
+ *
+ *  @note   writes the elements [first,last[ with all bits set (ones != 0) or
+ *          cleared, a chunk at a time when BV_SIMD is defined
+ */
+static inline void
+bv_fill(BV_TYPE *v, int first, int last, int ones) {
+int i = first;
+
+#ifdef BV_SIMD
+    while( i+BV_CHUNK <= last ) {
+        bv_chunkfill(v+i,ones);
+        i += BV_CHUNK;
+    }
+#endif
+    while( i < last )
+        v[i++] = ones ? BV_ALLONES : 0;
+}
+
 /**
  *  @brief  data type for parameters
  */
@@ -60,7 +183,7 @@ typedef BV_TYPE *bv_type;
 /// Clear bit BIT in bit vector X
 #define BV_CLEAR(X,BIT)     X[BV_INDEX(BIT)] &= ~(BV_MASK(BIT))
 /// Test bit BIT in bit vector X, return a non zero value if it is set
-#define BV_TEST(X,BIT)     (X[BV_INDEX(BIT])]&(BV_MASK(BIT)))
+#define BV_TEST(X,BIT)      (X[BV_INDEX(BIT)]&(BV_MASK(BIT)))
 
 #endif
 ///@}
@@ -122,6 +245,463 @@ int i = bv_index(bit);
 }
 
 
+/**
+ *  @brief  Word level bit scan
+ *
+ *  @note   When compiled with gcc or clang, the builtins are used. They map to
+ *          CLZ/RBIT on Cortex-M3 and above and to BSF/TZCNT/POPCNT on x86.
+ *          Define BV_NOBUILTINS to use the portable versions (e.g. Cortex-M0).
+ */
+///@{
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BV_NOBUILTINS)
+#define BV_USEBUILTINS
+#endif
+
+/**
+ *  @brief  bv_ctz
+ *
+ *  @note   returns the number of trailing zeros of a word. w must not be zero
+ */
+static inline int
+bv_ctz(BV_TYPE w) {
+#if defined(BV_USEBUILTINS) && (BV_WIDTH == 64)
+    return __builtin_ctzll(w);
+#elif defined(BV_USEBUILTINS)
+    return __builtin_ctz(w);
+#else
+int n = 0;
+#if BV_WIDTH == 64
+    if( (w&0xFFFFFFFF) == 0 ) { n += 32; w >>= 32; }
+#endif
+    if( (w&0xFFFF) == 0 ) { n += 16; w >>= 16; }
+    if( (w&0xFF) == 0 )   { n += 8;  w >>= 8;  }
+    if( (w&0xF) == 0 )    { n += 4;  w >>= 4;  }
+    if( (w&0x3) == 0 )    { n += 2;  w >>= 2;  }
+    if( (w&0x1) == 0 )    { n += 1; }
+    return n;
+#endif
+}
+
+/**
+ *  @brief  bv_clz
+ *
+ *  @note   returns the number of leading zeros of a word. w must not be zero
+ */
+static inline int
+bv_clz(BV_TYPE w) {
+#if defined(BV_USEBUILTINS) && (BV_WIDTH == 64)
+    return __builtin_clzll(w);
+#elif defined(BV_USEBUILTINS)
+    return __builtin_clz(w);
+#else
+int n = 0;
+#if BV_WIDTH == 64
+    if( (w>>32) == 0 )        { n += 32; w <<= 32; }
+#endif
+    if( (w>>(BV_BITS-16)) == 0 ) { n += 16; w <<= 16; }
+    if( (w>>(BV_BITS-8)) == 0 )  { n += 8;  w <<= 8;  }
+    if( (w>>(BV_BITS-4)) == 0 )  { n += 4;  w <<= 4;  }
+    if( (w>>(BV_BITS-2)) == 0 )  { n += 2;  w <<= 2;  }
+    if( (w>>(BV_BITS-1)) == 0 )  { n += 1; }
+    return n;
+#endif
+}
+
+/**
+ *  @brief  bv_popcount
+ *
+ *  @note   returns the number of bits set in a word
+ */
+static inline int
+bv_popcount(BV_TYPE w) {
+#if defined(BV_USEBUILTINS) && (BV_WIDTH == 64)
+    return __builtin_popcountll(w);
+#elif defined(BV_USEBUILTINS)
+    return __builtin_popcount(w);
+#else
+    w = w - ((w>>1)&(BV_ALLONES/3));
+    w = (w&(BV_ALLONES/5)) + ((w>>2)&(BV_ALLONES/5));
+    w = (w + (w>>4))&(BV_ALLONES/17);
+    return (int) ((BV_TYPE) (w*(BV_ALLONES/255))>>(BV_BITS-8));
+#endif
+}
+
+/**
+ *  @brief  bv_log2
+ *
+ *  @note   returns the position of the most significant bit set. w must not be zero
+ */
+static inline int
+bv_log2(BV_TYPE w) {
+    return BV_BITS-1-bv_clz(w);
+}
+///@}
+
+/**
+ *  @brief  bv_findnextset
+ *
+ *  @note   returns the first bit set in the range [start,end[ or -1 if
+ *          there is none. It scans a whole element per step.
+ */
+static inline int
+bv_findnextset(bv_type v, int start, int end) {
+int i,last;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    // Discard bits below start
+    w = v[i] & ~(bv_mask(start)-1);
+    while( w == 0 ) {
+        if( i == last )
+            return -1;
+        i++;
+#ifdef BV_SIMD
+        while( (i+BV_CHUNK <= last) && bv_chunkzero(v+i) )
+            i += BV_CHUNK;
+#endif
+        w = v[i];
+    }
+    start = (i<<BV_SHIFT)+bv_ctz(w);
+    return start < end ? start : -1;
+}
+
+/**
+ *  @brief  bv_findprevset
+ *
+ *  @note   returns the last bit set in the range [start,end[ or -1 if
+ *          there is none. It scans a whole element per step, downwards.
+ */
+static inline int
+bv_findprevset(bv_type v, int start, int end) {
+int i,first;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    i = bv_index(end-1);
+    first = bv_index(start);
+    // Discard bits from end on
+    w = v[i];
+    if( bv_bit(end) )
+        w &= bv_mask(end)-1;
+    while( w == 0 ) {
+        if( i == first )
+            return -1;
+        w = v[--i];
+    }
+    end = (i<<BV_SHIFT)+bv_log2(w);
+    return end >= start ? end : -1;
+}
+
+/**
+ *  @brief  bv_findnextclear
+ *
+ *  @note   returns the first bit cleared in the range [start,end[ or -1 if
+ *          there is none. It scans a whole element per step.
+ */
+static inline int
+bv_findnextclear(bv_type v, int start, int end) {
+int i,last;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    // Discard bits below start
+    w = ~v[i] & ~(bv_mask(start)-1);
+    while( w == 0 ) {
+        if( i == last )
+            return -1;
+        i++;
+#ifdef BV_SIMD
+        while( (i+BV_CHUNK <= last) && bv_chunkones(v+i) )
+            i += BV_CHUNK;
+#endif
+        w = ~v[i];
+    }
+    start = (i<<BV_SHIFT)+bv_ctz(w);
+    return start < end ? start : -1;
+}
+
+/**
+ *  @brief  bv_findfirstset
+ *
+ *  @note   returns the first bit set in bit vector or -1 if there is none
+ */
+static inline int
+bv_findfirstset(bv_type v, int size) {
+    return bv_findnextset(v,0,size);
+}
+
+/**
+ *  @brief  bv_findfirstclear
+ *
+ *  @note   returns the first bit cleared in bit vector or -1 if there is none
+ */
+static inline int
+bv_findfirstclear(bv_type v, int size) {
+    return bv_findnextclear(v,0,size);
+}
+
+/**
+ *  @brief  bv_countrange
+ *
+ *  @note   returns the number of bits set in the range [start,end[
+ */
+static inline int
+bv_countrange(bv_type v, int start, int end) {
+int i,last,n;
+BV_TYPE w;
+
+    if( start >= end )
+        return 0;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    w = v[i] & ~(bv_mask(start)-1);
+    n = 0;
+    while( i < last ) {
+        n += bv_popcount(w);
+        w = v[++i];
+    }
+    // Discard bits from end on
+    if( bv_bit(end) )
+        w &= bv_mask(end)-1;
+    return n+bv_popcount(w);
+}
+
+
+/**
+ *  @brief  Atomic operations
+ *
+ *  @note   They use the gcc/clang __atomic builtins (LDREX/STREX on ARMv7-M,
+ *          locked instructions on x86) or C11 atomics, also used with gcc/clang
+ *          when BV_C11ATOMICS is defined. The memory order is sequentially
+ *          consistent, except for the ones ending in X, that take it as
+ *          BV_RELAXED, BV_ACQUIRE or BV_RELEASE. These work on integers of any
+ *          size, e.g. counters of the heap. BV_HASATOMICS is defined when
+ *          available.
+ */
+///@{
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BV_C11ATOMICS)
+#define BV_HASATOMICS
+/// Atomic OR in an element. Returns the previous value
+#define BV_ATOMIC_OR(P,M)   __atomic_fetch_or((P),(M),__ATOMIC_SEQ_CST)
+/// Atomic AND in an element. Returns the previous value
+#define BV_ATOMIC_AND(P,M)  __atomic_fetch_and((P),(M),__ATOMIC_SEQ_CST)
+/// Atomic read of an element
+#define BV_ATOMIC_LOAD(P)   __atomic_load_n((P),__ATOMIC_SEQ_CST)
+/// Atomic read of an integer
+#define BV_ATOMIC_LOADINT(P) __atomic_load_n((P),__ATOMIC_SEQ_CST)
+/// Atomic add to an integer. Returns the previous value
+#define BV_ATOMIC_ADD(P,N)  __atomic_fetch_add((P),(N),__ATOMIC_SEQ_CST)
+/// Atomic exchange of an integer. Returns the previous value
+#define BV_ATOMIC_XCHG(P,N) __atomic_exchange_n((P),(N),__ATOMIC_SEQ_CST)
+/// Memory orders
+#define BV_RELAXED          __ATOMIC_RELAXED
+#define BV_ACQUIRE          __ATOMIC_ACQUIRE
+#define BV_RELEASE          __ATOMIC_RELEASE
+/// Operations with a memory order
+#define BV_ATOMIC_ORX(P,M,O)    __atomic_fetch_or((P),(M),(O))
+#define BV_ATOMIC_ANDX(P,M,O)   __atomic_fetch_and((P),(M),(O))
+#define BV_ATOMIC_ADDX(P,N,O)   __atomic_fetch_add((P),(N),(O))
+#define BV_ATOMIC_LOADX(P,O)    __atomic_load_n((P),(O))
+#define BV_ATOMIC_STOREX(P,V,O) __atomic_store_n((P),(V),(O))
+#define BV_ATOMIC_FENCE(O)      __atomic_thread_fence(O)
+#elif !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define BV_HASATOMICS
+/// Pointer to an integer as a pointer to the atomic type of the same size
+#define BV_ATOMIC_PTR(P)    _Generic((P), \
+        char *: (_Atomic char *) (P), \
+        signed char *: (_Atomic signed char *) (P), \
+        unsigned char *: (_Atomic unsigned char *) (P), \
+        short *: (_Atomic short *) (P), \
+        unsigned short *: (_Atomic unsigned short *) (P), \
+        int *: (_Atomic int *) (P), \
+        unsigned *: (_Atomic unsigned *) (P), \
+        long *: (_Atomic long *) (P), \
+        unsigned long *: (_Atomic unsigned long *) (P), \
+        long long *: (_Atomic long long *) (P), \
+        unsigned long long *: (_Atomic unsigned long long *) (P))
+#define BV_ATOMIC_OR(P,M)   atomic_fetch_or(BV_ATOMIC_PTR(P),(M))
+#define BV_ATOMIC_AND(P,M)  atomic_fetch_and(BV_ATOMIC_PTR(P),(M))
+#define BV_ATOMIC_LOAD(P)   atomic_load(BV_ATOMIC_PTR(P))
+#define BV_ATOMIC_LOADINT(P) atomic_load(BV_ATOMIC_PTR(P))
+#define BV_ATOMIC_ADD(P,N)  atomic_fetch_add(BV_ATOMIC_PTR(P),(N))
+#define BV_ATOMIC_XCHG(P,N) atomic_exchange(BV_ATOMIC_PTR(P),(N))
+#define BV_RELAXED          memory_order_relaxed
+#define BV_ACQUIRE          memory_order_acquire
+#define BV_RELEASE          memory_order_release
+#define BV_ATOMIC_ORX(P,M,O)    atomic_fetch_or_explicit(BV_ATOMIC_PTR(P),(M),(O))
+#define BV_ATOMIC_ANDX(P,M,O)   atomic_fetch_and_explicit(BV_ATOMIC_PTR(P),(M),(O))
+#define BV_ATOMIC_ADDX(P,N,O)   atomic_fetch_add_explicit(BV_ATOMIC_PTR(P),(N),(O))
+#define BV_ATOMIC_LOADX(P,O)    atomic_load_explicit(BV_ATOMIC_PTR(P),(O))
+#define BV_ATOMIC_STOREX(P,V,O) atomic_store_explicit(BV_ATOMIC_PTR(P),(V),(O))
+#define BV_ATOMIC_FENCE(O)      atomic_thread_fence(O)
+#endif
+///@}
+
+#ifdef BV_HASATOMICS
+/**
+ *  @brief  bv_atomic_testandset
+ *
+ *  @note   set bit BIT in bit vector v and returns a non zero value if it
+ *          was already set
+ */
+static inline BV_TYPE
+bv_atomic_testandset(bv_type v, int bit) {
+    return BV_ATOMIC_OR(&v[bv_index(bit)],bv_mask(bit)) & bv_mask(bit);
+}
+
+/**
+ *  @brief  bv_atomic_testandclear
+ *
+ *  @note   clear bit BIT in bit vector v and returns a non zero value if it
+ *          was set
+ */
+static inline BV_TYPE
+bv_atomic_testandclear(bv_type v, int bit) {
+    return BV_ATOMIC_AND(&v[bv_index(bit)],~bv_mask(bit)) & bv_mask(bit);
+}
+
+/**
+ *  @brief  bv_atomic_set
+ *
+ *  @note   set bit BIT in bit vector v
+ */
+static inline void
+bv_atomic_set(bv_type v, int bit) {
+    (void) BV_ATOMIC_OR(&v[bv_index(bit)],bv_mask(bit));
+}
+
+/**
+ *  @brief  bv_atomic_clear
+ *
+ *  @note   clear bit BIT in bit vector v
+ */
+static inline void
+bv_atomic_clear(bv_type v, int bit) {
+    (void) BV_ATOMIC_AND(&v[bv_index(bit)],~bv_mask(bit));
+}
+
+/**
+ *  @brief  bv_atomic_test
+ *
+ *  @note   returns a non zero value if bit BIT in bit vector V is set
+ */
+static inline BV_TYPE
+bv_atomic_test(bv_type v, int bit) {
+    return BV_ATOMIC_LOAD(&v[bv_index(bit)]) & bv_mask(bit);
+}
+
+/**
+ *  @brief  bv_atomic_findnextset
+ *
+ *  @note   same as bv_findnextset, but each element is read atomically
+ */
+static inline int
+bv_atomic_findnextset(bv_type v, int start, int end) {
+int i,last;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    w = BV_ATOMIC_LOAD(&v[i]) & ~(bv_mask(start)-1);
+    while( w == 0 ) {
+        if( i == last )
+            return -1;
+        i++;
+        w = BV_ATOMIC_LOAD(&v[i]);
+    }
+    start = (i<<BV_SHIFT)+bv_ctz(w);
+    return start < end ? start : -1;
+}
+
+/**
+ *  @brief  bv_atomic_findprevset
+ *
+ *  @note   same as bv_findprevset, but each element is read atomically
+ */
+static inline int
+bv_atomic_findprevset(bv_type v, int start, int end) {
+int i,first;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    i = bv_index(end-1);
+    first = bv_index(start);
+    w = BV_ATOMIC_LOAD(&v[i]);
+    if( bv_bit(end) )
+        w &= bv_mask(end)-1;
+    while( w == 0 ) {
+        if( i == first )
+            return -1;
+        w = BV_ATOMIC_LOAD(&v[--i]);
+    }
+    end = (i<<BV_SHIFT)+bv_log2(w);
+    return end >= start ? end : -1;
+}
+#endif
+
+
+/**
+ *  @brief  bv_setrange
+ *
+ *  @note   set bits in the range [start,end[. Inner elements are written as a whole
+ */
+static inline void
+bv_setrange(bv_type v, int start, int end) {
+int i,last;
+BV_TYPE first,tail;
+
+    if( start >= end )
+        return;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    first = ~(bv_mask(start)-1);
+    tail = bv_bit(end) ? bv_mask(end)-1 : BV_ALLONES;
+    if( i == last ) {
+        v[i] |= first&tail;
+        return;
+    }
+    v[i] |= first;
+    bv_fill(v,i+1,last,1);
+    v[last] |= tail;
+}
+
+/**
+ *  @brief  bv_clearrange
+ *
+ *  @note   clear bits in the range [start,end[. Inner elements are written as a whole
+ */
+static inline void
+bv_clearrange(bv_type v, int start, int end) {
+int i,last;
+BV_TYPE first,tail;
+
+    if( start >= end )
+        return;
+    i = bv_index(start);
+    last = bv_index(end-1);
+    first = ~(bv_mask(start)-1);
+    tail = bv_bit(end) ? bv_mask(end)-1 : BV_ALLONES;
+    if( i == last ) {
+        v[i] &= ~(first&tail);
+        return;
+    }
+    v[i] &= ~first;
+    bv_fill(v,i+1,last,0);
+    v[last] &= ~tail;
+}
+
+
 /**
  *  @brief  bv_setall
  *
@@ -129,10 +709,7 @@ int i = bv_index(bit);
  */
 static inline void
 bv_setall(bv_type v, int size) {
-int i;
-    for(i=0;i<BV_SIZE(size);i++) {
-        v[i] = (unsigned) -1;
-    }
+    bv_fill(v,0,BV_SIZE(size),1);
 }
 
 
@@ -143,10 +720,7 @@ int i;
  */
 static inline void
 bv_clearall(bv_type v, int size) {
-int i;
-    for(i=0;i<BV_SIZE(size);i++) {
-        v[i] = 0;
-    }
+    bv_fill(v,0,BV_SIZE(size),0);
 }
 
 
@@ -159,7 +733,7 @@ static inline void
 bv_toggleall(bv_type v, int size) {
 int i;
     for(i=0;i<BV_SIZE(size);i++) {
-        v[i] |= (unsigned) -1;
+        v[i] ^= BV_ALLONES;
     }
 }
 
@@ -181,7 +755,7 @@ static void bv_dump( bv_type x, int size) {
 int i;
 
     for(i=0;i<BV_SIZE(size);i++) {
-        printf("%03d: %08X\n",i,(unsigned) x[i]);
+        printf("%03d: " BV_FORMAT "\n",i,x[i]);
     }
 }
 #endif
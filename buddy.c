@@ -41,46 +41,2510 @@
  *
  *    By observing the two bits, one can determine its status.
  *
+ *  @note
+ *    To avoid a search over the tree, a third bit vector, avail, has a bit set for each
+ *    block that is free and can be allocated as a whole (its parent is split). Since the
+ *    nodes of a level are stored contiguously, avail is also a free bitmap per level.
+ *    A counter of free blocks per level tells which levels are worth searching.
+ *
+ *    An allocation looks for a free block at the level of the requested size. If there
+ *    is none, it takes the first free block of the nearest level above and splits it down,
+ *    marking the right halves as available. A free merges the block with its buddy while
+ *    the buddy is available, so it visits at most one node per level.
+ *
+ *  @note
+ *    The search of a set bit in a level of avail would scan words in proportion to the
+ *    size of the heap, so avail has summary vectors, each with a bit per word of the one
+ *    below (see findavail). A search reads two words per vector, which makes an
+ *    allocation O(log N) too.
+ *
+ *  @note
+ *    When the size of the area is not a power of 2, the tree covers the next power of 2.
+ *    The blocks at its end that do not exist are marked used at the start, so they are
+ *    never allocated nor merged with their buddies, and the other routines do not change.
+ *
+ *  @note
+ *    The avail bitmaps make the default placement the smallest free block that fits, at
+ *    the lowest address. The other policies (buddy_heap_setpolicy) only change which set
+ *    bit of a level is taken, or which level: the highest address, a block whose buddy is
+ *    allocated, or the lowest address at any level. None of them walks the tree.
+ *
+ *  @note
+ *    The routines never write to the area, so a heap with a purge routine
+ *    (buddy_heap_setpurge) can give back the pages of the large free blocks, e.g. to the
+ *    system (see buddymmap.c). Each block is purged once, when a free forms it.
+ *
+ *  @note
+ *    A free and buddy_heap_usable_size find the node of a block by its address, going up
+ *    from its leaf while the levels can start a block there. When BUDDY_ORDERMAP is
+ *    defined, the order of each block in use is also kept in 4 bits of its first leaf,
+ *    written with its used bit, and the node is computed from it.
+ *
+ *  @note
+ *    When BUDDY_CHECKED is defined, the routines write to the blocks. An allocation with
+ *    at least 16 bytes left in its block writes a canary after the request and, at the
+ *    end of the block, a tag with the size left (keyed with the offset of the block, so
+ *    it holds in images mapped at other addresses), and marks the first leaf of the block
+ *    in guard. A free checks them and poisons the start of the block. Since a node is
+ *    only found used at a level where a block can start at the address (findblock), a
+ *    free of an address inside a block, or of a block already freed, finds no node and
+ *    is reported. Both cost a few writes per operation, and no search.
+ *
+ *  @note
+ *    The state of a heap is its structure and the bit vectors, so it can be kept in an
+ *    image (buddy_heap_format) with the vectors given by offsets, and attached again at
+ *    other addresses. buddy_heap_check walks the nodes reached through split nodes and
+ *    checks the rest by counting bits, and can rebuild the tree from the used blocks.
+ *
+ *  @note
+ *    When BUDDY_LAZY is defined, a freed block of one of the lowest levels is not made
+ *    available. It is kept in a list for its level (with its used bit clear, so it can
+ *    not be freed twice) and the next allocation of that size takes it back, without
+ *    searching nor splitting. When a list is full, its older half is merged as usual.
+ *    All lists are merged when an allocation fails.
+ *
+ *  @note
+ *    When BUDDY_BLOCKED is defined, the used and split bits of a node are stored side by
+ *    side, in the same element, and the tree is cut in bands of BUDDY_BLOCKHEIGHT levels
+ *    (the top band has the levels left over). Each node of the top level of a band is the
+ *    root of a subtree that is stored in its own block, in the same order as the tree
+ *    (the first pair of a block is not used).
+ *
+ *       block 0: top band | band 1: blocks 1 to 2^s | band 2: ...
+ *
+ *    A walk from a leaf to the root visits one block per band, instead of two elements
+ *    (one of used and one of split) per level. avail is still stored by level, since it
+ *    is searched level by level.
+ *
+ *  @note
+ *    When BUDDY_ATOMIC is defined, blocks of the minimal size can be allocated and freed
+ *    without a lock. An allocation claims an available leaf by atomically clearing its
+ *    avail bit; only one of the competitors sees it set. A free atomically clears the used
+ *    bit of the leaf and sets its avail bit, but does not merge. If the buddy is also
+ *    available, it sets pending. The next allocation of a larger block (with the lock)
+ *    merges these pairs of leaves. The routines that change the tree structure must still
+ *    be serialized, and all updates of the bit vectors are atomic because the leaves share
+ *    elements with the upper levels.
+ *
+ *  @note
+ *    When BUDDY_TRACE is defined, the public routines of a heap with a trace write a
+ *    record of each operation to it (see buddytrace.c). They call the routines that
+ *    do the work (allocblock, freeblock, ...), so an operation made of others, as a
+ *    realloc that copies, is recorded once.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef DEBUG
+#include <stdio.h>
+#endif
+
+
+#include "bitvector.h"
+#include "buddy.h"
+#ifdef BUDDY_TRACE
+#include "buddytrace.h"
+#endif
+
+#if defined(BUDDY_ATOMIC) && !defined(BV_HASATOMICS)
+#error "BUDDY_ATOMIC needs atomic operations"
+#endif
+
+/**
+ *  @brief  Updates of the bit vectors and counters
+ *
+ *  @note   takebit clears a bit and returns a non zero value if it was set
+ */
+///@{
+#ifdef BUDDY_ATOMIC
+static inline void setbit(bv_type v, int k) { bv_atomic_set(v,k); }
+static inline void clearbit(bv_type v, int k) { bv_atomic_clear(v,k); }
+static inline BV_TYPE testbit(bv_type v, int k) { return bv_atomic_test(v,k); }
+static inline BV_TYPE takebit(bv_type v, int k) { return bv_atomic_testandclear(v,k); }
+static inline int findbit(bv_type v, int start, int end) {
+    return bv_atomic_findnextset(v,start,end);
+}
+static inline int findlastbit(bv_type v, int start, int end) {
+    return bv_atomic_findprevset(v,start,end);
+}
+static inline void setrange(bv_type v, int start, int end) {
+    while( start < end )
+        bv_atomic_set(v,start++);
+}
+static inline void clearrange(bv_type v, int start, int end) {
+    while( start < end )
+        bv_atomic_clear(v,start++);
+}
+static inline void addfree(buddy_heap *heap, int l, int n) {
+    (void) BV_ATOMIC_ADD(&heap->nfree[l],n);
+}
+static inline int getfree(buddy_heap *heap, int l) {
+    return BV_ATOMIC_LOADINT(&heap->nfree[l]);
+}
+#else
+static inline void setbit(bv_type v, int k) { bv_set(v,k); }
+static inline void clearbit(bv_type v, int k) { bv_clear(v,k); }
+static inline BV_TYPE testbit(bv_type v, int k) { return bv_test(v,k); }
+static inline BV_TYPE takebit(bv_type v, int k) {
+BV_TYPE t = bv_test(v,k);
+    bv_clear(v,k);
+    return t;
+}
+static inline int findbit(bv_type v, int start, int end) {
+    return bv_findnextset(v,start,end);
+}
+static inline int findlastbit(bv_type v, int start, int end) {
+    return bv_findprevset(v,start,end);
+}
+static inline void setrange(bv_type v, int start, int end) { bv_setrange(v,start,end); }
+static inline void clearrange(bv_type v, int start, int end) { bv_clearrange(v,start,end); }
+static inline void addfree(buddy_heap *heap, int l, int n) { heap->nfree[l] += n; }
+static inline int getfree(buddy_heap *heap, int l) { return heap->nfree[l]; }
+#endif
+///@}
+
+/**
+ *  @brief  first index of a level
+ */
+static inline int levelfirst(int l) { return (1<<l)-1; }
+
+/**
+ *  @brief  Navigation in the tree
+ */
+///@{
+static inline int parent(int k) { return (k-1)/2; }
+static inline int leftchild(int k) { return 2*k+1; }
+static inline int buddyof(int k) { return ((k-1)^1)+1; }
+///@}
+
+/**
+ *  @brief  Access to the used and split bits of a node
+ *
+ *  @note   usedrange and splitrange mark the nodes from start to end-1, all in
+ *          the same level. freerange clears both bits of these nodes, and
+ *          countused counts those that are used.
+ */
+///@{
+#ifdef BUDDY_BLOCKED
+static inline int nodebit(buddy_heap *heap, int k) {
+int l = bv_log2(k+1);
+int i = k-levelfirst(l);
+int r = heap->bandlevel[l];
+
+    return 2*(heap->bandbase[l]+((i>>r)<<BUDDY_BLOCKHEIGHT)+(1<<r)+(i&((1<<r)-1)));
+}
+static inline BV_TYPE isused(buddy_heap *heap, int k) { return testbit(heap->nodes,nodebit(heap,k)); }
+static inline void setusedbit(buddy_heap *heap, int k) { setbit(heap->nodes,nodebit(heap,k)); }
+static inline void clearusedbit(buddy_heap *heap, int k) { clearbit(heap->nodes,nodebit(heap,k)); }
+static inline BV_TYPE takeusedbit(buddy_heap *heap, int k) { return takebit(heap->nodes,nodebit(heap,k)); }
+static inline BV_TYPE issplit(buddy_heap *heap, int k) { return testbit(heap->nodes,nodebit(heap,k)+1); }
+static inline void setsplit(buddy_heap *heap, int k) { setbit(heap->nodes,nodebit(heap,k)+1); }
+static inline void clearsplit(buddy_heap *heap, int k) { clearbit(heap->nodes,nodebit(heap,k)+1); }
+static inline void usedbits(buddy_heap *heap, int start, int end) {
+    while( start < end )
+        setusedbit(heap,start++);
+}
+static inline void splitrange(buddy_heap *heap, int start, int end) {
+    while( start < end )
+        setsplit(heap,start++);
+}
+static inline void freerange(buddy_heap *heap, int start, int end) {
+    while( start < end ) {
+        clearusedbit(heap,start);
+        clearsplit(heap,start++);
+    }
+}
+static inline int countused(buddy_heap *heap, int start, int end) {
+int n = 0;
+    while( start < end )
+        n += isused(heap,start++) != 0;
+    return n;
+}
+#else
+static inline BV_TYPE isused(buddy_heap *heap, int k) { return testbit(heap->used,k); }
+static inline void setusedbit(buddy_heap *heap, int k) { setbit(heap->used,k); }
+static inline void clearusedbit(buddy_heap *heap, int k) { clearbit(heap->used,k); }
+static inline BV_TYPE takeusedbit(buddy_heap *heap, int k) { return takebit(heap->used,k); }
+static inline BV_TYPE issplit(buddy_heap *heap, int k) { return testbit(heap->split,k); }
+static inline void setsplit(buddy_heap *heap, int k) { setbit(heap->split,k); }
+static inline void clearsplit(buddy_heap *heap, int k) { clearbit(heap->split,k); }
+static inline void usedbits(buddy_heap *heap, int start, int end) {
+    setrange(heap->used,start,end);
+}
+static inline void splitrange(buddy_heap *heap, int start, int end) {
+    setrange(heap->split,start,end);
+}
+static inline void freerange(buddy_heap *heap, int start, int end) {
+    clearrange(heap->used,start,end);
+    clearrange(heap->split,start,end);
+}
+static inline int countused(buddy_heap *heap, int start, int end) {
+    return bv_countrange(heap->used,start,end);
+}
+#endif
+///@}
+
+/**
+ *  @brief  Order map
+ *
+ *  @note   With BUDDY_ORDERMAP, each leaf has 4 bits with the order plus 1 of
+ *          the used node that starts at it, or 0. Only one used node can start
+ *          at a leaf, so setused and clearused keep it together with the used
+ *          bits. An order of BUDDY_ORDERMAX or more is kept as BUDDY_ORDERMAX+1
+ *          and its node is searched. freerange does not change the map: the
+ *          callers clear the leaves of the subtree (clearorders).
+ */
+///@{
+#ifdef BUDDY_ORDERMAP
+#define BUDDY_ORDERMAX  14
+static inline int firstleaf(buddy_heap *heap, int k, int l) {
+    return (k-levelfirst(l))<<(heap->leaflevel-l);
+}
+static inline int getorder(buddy_heap *heap, int d) {
+#ifdef BUDDY_ATOMIC
+    return (BV_ATOMIC_LOADX(&heap->ordermap[d>>1],BV_RELAXED)>>((d&1)<<2))&0xF;
+#else
+    return (heap->ordermap[d>>1]>>((d&1)<<2))&0xF;
+#endif
+}
+static inline void putorder(buddy_heap *heap, int d, int c) {
+int s = (d&1)<<2;
+#ifdef BUDDY_ATOMIC
+    // The other leaf of the byte may be changed by the routines without lock
+    (void) BV_ATOMIC_ANDX(&heap->ordermap[d>>1],(uint8_t) ~(0xF<<s),BV_RELAXED);
+    (void) BV_ATOMIC_ORX(&heap->ordermap[d>>1],(uint8_t) (c<<s),BV_RELAXED);
+#else
+    heap->ordermap[d>>1] = (uint8_t) ((heap->ordermap[d>>1]&~(0xF<<s))|(c<<s));
+#endif
+}
+static inline int ordercode(buddy_heap *heap, int l) {
+int o = heap->leaflevel-l;
+    return (o < BUDDY_ORDERMAX ? o : BUDDY_ORDERMAX)+1;
+}
+static inline void setused(buddy_heap *heap, int k) {
+int l = bv_log2(k+1);
+    setusedbit(heap,k);
+    putorder(heap,firstleaf(heap,k,l),ordercode(heap,l));
+}
+static inline void clearused(buddy_heap *heap, int k) {
+int l = bv_log2(k+1);
+    clearusedbit(heap,k);
+    putorder(heap,firstleaf(heap,k,l),0);
+}
+static inline BV_TYPE takeused(buddy_heap *heap, int k) {
+int l = bv_log2(k+1);
+BV_TYPE t = takeusedbit(heap,k);
+    if( t )
+        putorder(heap,firstleaf(heap,k,l),0);
+    return t;
+}
+static inline void usedrange(buddy_heap *heap, int start, int end) {
+int l = bv_log2(start+1);
+int c = ordercode(heap,l);
+int k;
+    usedbits(heap,start,end);
+    for(k=start;k<end;k++)
+        putorder(heap,firstleaf(heap,k,l),c);
+}
+/// Clears the map of n leaves from leaf d (d is a multiple of n, a power of 2)
+static inline void clearorders(buddy_heap *heap, int d, int n) {
+    if( n == 1 )
+        putorder(heap,d,0);
+    else
+        memset(heap->ordermap+(d>>1),0,n>>1);
+}
+#else
+static inline void setused(buddy_heap *heap, int k) { setusedbit(heap,k); }
+static inline void clearused(buddy_heap *heap, int k) { clearusedbit(heap,k); }
+static inline BV_TYPE takeused(buddy_heap *heap, int k) { return takeusedbit(heap,k); }
+static inline void usedrange(buddy_heap *heap, int start, int end) { usedbits(heap,start,end); }
+static inline void clearorders(buddy_heap *heap, int d, int n) { (void) heap; (void) d; (void) n; }
+#endif
+///@}
+
+/**
+ *  @brief  Summary of avail
+ *
+ *  @note   summary[0] has a bit per element of avail, summary[1] a bit per
+ *          element of summary[0], and so on up to a single element, so a
+ *          search of set bits of avail visits one element per vector going up
+ *          and one going down, instead of all the elements of a level.
+ *
+ *  @note   A set bit of avail always has its bits set in the summary: setavail
+ *          sets them, up to the first one already set. Taking or clearing a bit
+ *          of avail does not touch the summary, so a summary bit may cover an
+ *          element without set bits. The searches clear such a bit when they
+ *          find it, and set it again if a bit was set meanwhile (by a routine
+ *          without lock), so each stale bit costs one visit.
+ */
+///@{
+#ifdef BUDDY_ATOMIC
+static inline BV_TYPE element(bv_type v, int i) { return BV_ATOMIC_LOAD(&v[i]); }
+#else
+static inline BV_TYPE element(bv_type v, int i) { return v[i]; }
+#endif
+/// Vector i of the hierarchy (0 is avail)
+static inline bv_type summaryvector(buddy_heap *heap, int i) {
+    return i == 0 ? heap->avail : heap->summary[i-1];
+}
+static inline void
+setavail(buddy_heap *heap, int k) {
+int i;
+
+    setbit(heap->avail,k);
+    for(i=0;i<heap->nsummary;i++) {
+        k = bv_index(k);
+        if( testbit(heap->summary[i],k) )
+            return;
+        setbit(heap->summary[i],k);
+    }
+}
+/// Clears the bit k of vector i (i > 0), whose element of vector i-1 looked empty, and
+/// returns 1, or 0 if the element has bits again
+static inline int
+clearstale(buddy_heap *heap, int i, int k) {
+    clearbit(heap->summary[i-1],k);
+    if( element(summaryvector(heap,i-1),k) == 0 )
+        return 1;
+    setbit(heap->summary[i-1],k);
+    return 0;
+}
+/// First set bit of avail in [start,end[ or -1
+static int
+findavail(buddy_heap *heap, int start, int end) {
+int i,k;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    k = start;
+    i = 0;
+    for(;;) {
+        // Up, to the first vector with a set bit from k in the element of k
+        for(;;) {
+            if( k > ((end-1)>>(i*BV_SHIFT)) )
+                return -1;
+            w = element(summaryvector(heap,i),bv_index(k))&~(bv_mask(k)-1);
+            if( w ) {
+                k = (k&~BV_BITMASK)+bv_ctz(w);
+                break;
+            }
+            if( i == heap->nsummary )
+                return -1;
+            k = bv_index(k)+1;
+            i++;
+        }
+        // Down, to the first set bit of each element
+        while( i > 0 ) {
+            w = element(summaryvector(heap,i-1),k);
+            if( w == 0 )
+                break;
+            k = (k<<BV_SHIFT)+bv_ctz(w);
+            i--;
+        }
+        if( i == 0 )
+            return k < end ? k : -1;
+        k += clearstale(heap,i,k);
+    }
+}
+/// Last set bit of avail in [start,end[ or -1
+static int
+findlastavail(buddy_heap *heap, int start, int end) {
+int i,k;
+BV_TYPE w;
+
+    if( start >= end )
+        return -1;
+    k = end-1;
+    i = 0;
+    for(;;) {
+        // Up, to the first vector with a set bit up to k in the element of k
+        for(;;) {
+            if( (k < 0) || (k < (start>>(i*BV_SHIFT))) )
+                return -1;
+            w = element(summaryvector(heap,i),bv_index(k));
+            if( bv_bit(k) != BV_BITMASK )
+                w &= bv_mask(k+1)-1;
+            if( w ) {
+                k = (k&~BV_BITMASK)+bv_log2(w);
+                break;
+            }
+            if( i == heap->nsummary )
+                return -1;
+            k = bv_index(k)-1;
+            i++;
+        }
+        // Down, to the last set bit of each element
+        while( i > 0 ) {
+            w = element(summaryvector(heap,i-1),k);
+            if( w == 0 )
+                break;
+            k = (k<<BV_SHIFT)+bv_log2(w);
+            i--;
+        }
+        if( i == 0 )
+            return k >= start ? k : -1;
+        k -= clearstale(heap,i,k);
+    }
+}
+/// Clears avail and the summary
+static void
+clearavail(buddy_heap *heap) {
+int i,n;
+
+    bv_clearall(heap->avail,2*heap->mapsize);
+    n = BV_SIZE(2*heap->mapsize);
+    for(i=0;i<heap->nsummary;i++) {
+        bv_clearall(heap->summary[i],n);
+        n = BV_SIZE(n);
+    }
+}
+///@}
+
+/**
+ *  @brief  size of a block at a level
+ */
+static inline size_t levelsize(buddy_heap *heap, int l) {
+    return ((size_t) 1)<<(heap->minshift+heap->leaflevel-l);
+}
+
+/**
+ *  @brief  blockaddr
+ *
+ *  @note   returns the address of the block k at level l
+ */
+static inline char *
+blockaddr(buddy_heap *heap, int k, int l) {
+    return heap->base+(size_t) (k-levelfirst(l))*levelsize(heap,l);
+}
+
+/**
+ *  @brief  level of the blocks used to attend a request of size bytes
+ */
+static inline int sizelevel(buddy_heap *heap, size_t size) {
+    if( size <= heap->minsize )
+        return heap->leaflevel;
+    return heap->leaflevel-bv_log2((size-1)>>heap->minshift)-1;
+}
+
+/**
+ *  @brief  Statistics counters
+ *
+ *  @note   With BUDDY_ATOMIC, they are updated atomically, since the lock free
+ *          routines update them too. The peak is then approximate.
+ */
+///@{
+#ifdef BUDDY_STATS
+#ifdef BUDDY_ATOMIC
+#define STATADD(F,N)    ((void) BV_ATOMIC_ADDX(&(F),(N),BV_RELAXED))
+#else
+#define STATADD(F,N)    ((F) += (N))
+#endif
+static inline void countalloc(buddy_heap *heap, int l, size_t size, int n) {
+size_t s = levelsize(heap,l)*n;
+    STATADD(heap->counters.allocs[heap->leaflevel-l],n);
+    STATADD(heap->counters.requested,(unsigned long long) size*n);
+    STATADD(heap->counters.allocated,(unsigned long long) s);
+    STATADD(heap->counters.inuse,s);
+    if( heap->counters.inuse > heap->counters.peak )
+        heap->counters.peak = heap->counters.inuse;
+}
+static inline void countfree(buddy_heap *heap, int l) {
+    STATADD(heap->counters.frees[heap->leaflevel-l],1);
+    STATADD(heap->counters.inuse,-levelsize(heap,l));
+}
+static inline void countfail(buddy_heap *heap) {
+    STATADD(heap->counters.failures,1);
+}
+static inline void countfrees(buddy_heap *heap, int l, int n) {
+    STATADD(heap->counters.frees[heap->leaflevel-l],n);
+}
+#else
+static inline void countalloc(buddy_heap *heap, int l, size_t size, int n) {
+    (void) heap; (void) l; (void) size; (void) n;
+}
+static inline void countfree(buddy_heap *heap, int l) { (void) heap; (void) l; }
+static inline void countfail(buddy_heap *heap) { (void) heap; }
+static inline void countfrees(buddy_heap *heap, int l, int n) { (void) heap; (void) l; (void) n; }
+#endif
+///@}
+
+/**
+ *  @brief  Trace of the operations
+ *
+ *  @note   With BUDDY_TRACE, TRACE writes a record when the heap has a trace.
+ *          Blocks are recorded as offsets in minimal blocks, and a null address
+ *          (a failed allocation) as BUDDY_TRACE_NOBLOCK.
+ */
+///@{
+#ifdef BUDDY_TRACE
+static inline uint32_t traceblock(buddy_heap *heap, void *addr) {
+    if( addr == 0 )
+        return BUDDY_TRACE_NOBLOCK;
+    return (uint32_t) (((char *) addr-heap->base)>>heap->minshift);
+}
+#define TRACE(H,OP,S,A,O,AL) \
+        do { if( (H)->trace ) buddy_trace_record((H)->trace,BUDDY_TRACE_##OP,(S), \
+                              traceblock((H),(A)),traceblock((H),(O)),(int) (AL)); } while(0)
+#else
+#define TRACE(H,OP,S,A,O,AL)    ((void) 0)
+#endif
+///@}
+
+/**
+ *  @brief  Checks of BUDDY_CHECKED
+ *
+ *  @note   guard writes the trailer of a block just allocated for size bytes,
+ *          or clears its guard bit when there is no room. retire checks the
+ *          trailer of the block k at level l, that is being freed, and poisons
+ *          it (checktrailer only checks it, for a realloc). report counts an
+ *          error and calls the error routine.
+ */
+///@{
+#ifdef BUDDY_CHECKED
+static void
+report(buddy_heap *heap, int error, void *addr) {
+#ifdef BUDDY_ATOMIC
+    (void) BV_ATOMIC_ADDX(&heap->errors,1,BV_RELAXED);
+#else
+    heap->errors++;
+#endif
+    if( heap->error )
+        heap->error(addr,error,heap->errorarg);
+#ifdef DEBUG
+    else
+        fprintf(stderr,"buddy: error %d at %p\n",error,addr);
+#endif
+}
+
+static void
+guard(buddy_heap *heap, char *p, size_t size) {
+size_t b = levelsize(heap,sizelevel(heap,size));
+int d = (int) ((size_t) (p-heap->base)>>heap->minshift);
+uint64_t c = BUDDY_CANARY;
+size_t tag;
+
+    if( b-size < sizeof(c)+sizeof(tag) ) {
+        clearbit(heap->guard,d);
+        return;
+    }
+    tag = (b-size)^(size_t) BUDDY_CANARY^(size_t) (p-heap->base);
+    memcpy(p+size,&c,sizeof(c));
+    memcpy(p+b-sizeof(tag),&tag,sizeof(tag));
+    setbit(heap->guard,d);
+}
+
+static void
+checktrailer(buddy_heap *heap, int k, int l) {
+char *p = blockaddr(heap,k,l);
+size_t b = levelsize(heap,l);
+int d = (k-levelfirst(l))<<(heap->leaflevel-l);
+uint64_t c;
+size_t tag,left;
+
+    if( takebit(heap->guard,d) == 0 )
+        return;
+    memcpy(&tag,p+b-sizeof(tag),sizeof(tag));
+    left = tag^(size_t) BUDDY_CANARY^(size_t) (p-heap->base);
+    if( (left < sizeof(c)+sizeof(tag)) || (left > b) ) {
+        // The tag itself was overwritten
+        report(heap,BUDDY_ERROR_CANARY,p);
+        return;
+    }
+    memcpy(&c,p+b-left,sizeof(c));
+    if( c != BUDDY_CANARY )
+        report(heap,BUDDY_ERROR_CANARY,p);
+}
+
+static inline void
+retire(buddy_heap *heap, int k, int l) {
+size_t b = levelsize(heap,l);
+
+    checktrailer(heap,k,l);
+    memset(blockaddr(heap,k,l),BUDDY_POISONBYTE,b < BUDDY_POISONSIZE ? b : BUDDY_POISONSIZE);
+}
+#define GUARD(H,P,S)            do { if( P ) guard((H),(char *) (P),(S)); } while(0)
+#define CHECKTRAILER(H,K,L)     checktrailer((H),(K),(L))
+#define RETIRE(H,K,L)           retire((H),(K),(L))
+#define REPORT(H,E,A)           report((H),(E),(A))
+#else
+#define GUARD(H,P,S)            ((void) 0)
+#define CHECKTRAILER(H,K,L)     ((void) 0)
+#define RETIRE(H,K,L)           ((void) 0)
+#define REPORT(H,E,A)           ((void) 0)
+#endif
+///@}
+
+/**
+ *  @brief  ispowerof2
+ */
+static inline int ispowerof2(size_t n) { return (n != 0) && ((n&(n-1)) == 0); }
+
+/**
+ *  @brief  cuttail
+ *
+ *  @note   makes the leaves of the free block k at level l that are before
+ *          leaf n available as the largest possible blocks and marks used the
+ *          blocks after them. Only the nodes along the path to the leaf n are
+ *          split.
+ */
+static void
+cuttail(buddy_heap *heap, int k, int l, int n) {
+int a,half;
+
+    a = (k-levelfirst(l))<<(heap->leaflevel-l);
+    while( a+(heap->mapsize>>l) > n ) {
+        setsplit(heap,k);
+        k = leftchild(k);
+        l++;
+        half = heap->mapsize>>l;
+        if( a+half >= n ) {
+            // Right half does not exist
+            setused(heap,k+1);
+        } else {
+            setavail(heap,k);
+            addfree(heap,l,1);
+            k++;
+            a += half;
+        }
+    }
+    setavail(heap,k);
+    addfree(heap,l,1);
+}
+
+/**
+ *  @brief  clearheap
+ *
+ *  @note   clears the bit vectors and counters and makes the whole area free,
+ *          except the blocks beyond its end. The vectors are cleared a word (or
+ *          a chunk) at a time.
+ */
+static void
+clearheap(buddy_heap *heap) {
+int l;
+
+#ifdef BUDDY_BLOCKED
+    // The blocks of the last band end the vector
+    l = heap->leaflevel;
+    bv_clearall(heap->nodes,2*(heap->bandbase[l]+((1<<(l-heap->bandlevel[l]))<<BUDDY_BLOCKHEIGHT)));
+#else
+    bv_clearall(heap->used,2*heap->mapsize);
+    bv_clearall(heap->split,2*heap->mapsize);
+#endif
+    clearavail(heap);
+#ifdef BUDDY_CHECKED
+    bv_clearall(heap->guard,heap->mapsize);
+#endif
+    clearorders(heap,0,heap->mapsize);
+
+    for(l=0;l<BUDDY_MAXLEVELS;l++)
+        heap->nfree[l] = 0;
+
+    cuttail(heap,0,0,(int) (heap->size>>heap->minshift));
+#ifdef BUDDY_ATOMIC
+    heap->pending = 0;
+#endif
+#ifdef BUDDY_LAZY
+    for(l=0;l<BUDDY_LAZY_LEVELS;l++)
+        heap->nlazy[l] = 0;
+#endif
+}
+
+/**
+ *  @brief  placeextra
+ *
+ *  @note   sets the vectors that follow avail in the metadata: its summary,
+ *          guard with BUDDY_CHECKED and the order map with BUDDY_ORDERMAP
+ */
+static inline void
+placeextra(buddy_heap *heap) {
+bv_type v = heap->avail+BV_SIZE(2*heap->mapsize);
+int n = BV_SIZE(2*heap->mapsize);
+
+    // Summary vectors, down to a single element
+    heap->nsummary = 0;
+    while( n > 1 ) {
+        heap->summary[heap->nsummary++] = v;
+        n = BV_SIZE(n);
+        v += n;
+    }
+#ifdef BUDDY_CHECKED
+    heap->guard = v;
+    v += BV_SIZE(heap->mapsize);
+#endif
+#ifdef BUDDY_ORDERMAP
+    heap->ordermap = (uint8_t *) v;
+#endif
+    (void) v;
+}
+
+/**
+ *  @brief  newgeneration
+ *
+ *  @note   returns a generation not given before to any heap of the process,
+ *          so a heap initialized again over an old one does not repeat the
+ *          generations of the old one
+ */
+static unsigned generations;
+
+static unsigned
+newgeneration(void) {
+#ifdef BV_HASATOMICS
+    return BV_ATOMIC_ADD(&generations,1)+1;
+#else
+    return ++generations;
+#endif
+}
+
+/**
+ *  @brief  buddy_heap_init
+ *
+ *  @note   metadata must point to a buffer with at least
+ *          BUDDY_METADATASIZE(size,minsize) bytes, aligned as BV_TYPE.
+ *
+ *  @note   size does not need to be a power of 2. It is rounded down to a
+ *          multiple of minsize.
+ *
+ *  @note   returns 0 when OK, -1 when the sizes are not valid
+ */
+int
+buddy_heap_init(buddy_heap *heap, void *base, size_t size, size_t minsize, void *metadata) {
+#ifdef BUDDY_BLOCKED
+int l,first,height,slots;
+#else
+int words;
+#endif
+
+    if( !ispowerof2(minsize) || (minsize > size) )
+        return -1;
+    if( (size/minsize) > BUDDY_MAXLEAVES )
+        return -1;
+#ifdef BUDDY_BLOCKED
+    // Two bits per node
+    if( (size/minsize) > (((size_t) 1)<<(BUDDY_MAXLEVELS-4)) )
+        return -1;
+#endif
+
+    heap->base     = (char *) base;
+    heap->size     = size-(size&(minsize-1));
+    heap->minsize  = minsize;
+    heap->mapsize  = 1;
+    while( heap->mapsize < (int) (size/minsize) )
+        heap->mapsize *= 2;
+    heap->minshift = 0;
+    while( (((size_t) 1)<<heap->minshift) < minsize )
+        heap->minshift++;
+    heap->leaflevel = bv_log2(heap->mapsize);
+
+#ifdef BUDDY_BLOCKED
+    // The top band has the levels left over. The others have BUDDY_BLOCKHEIGHT levels
+    slots = 0;
+    first = 0;
+    height = heap->leaflevel%BUDDY_BLOCKHEIGHT+1;
+    for(l=0;l<=heap->leaflevel;l++) {
+        if( l == first+height ) {
+            slots += (1<<first)<<BUDDY_BLOCKHEIGHT;
+            first = l;
+            height = BUDDY_BLOCKHEIGHT;
+        }
+        heap->bandbase[l] = slots;
+        heap->bandlevel[l] = l-first;
+    }
+    slots += (1<<first)<<BUDDY_BLOCKHEIGHT;
+
+    heap->nodes = (bv_type) metadata;
+    heap->avail = heap->nodes+BV_SIZE(2*slots);
+#else
+    words = BV_SIZE(2*heap->mapsize);
+    heap->used  = (bv_type) metadata;
+    heap->split = heap->used+words;
+    heap->avail = heap->split+words;
+#endif
+    placeextra(heap);
+#ifdef BUDDY_CHECKED
+    heap->error = 0;
+    heap->errorarg = 0;
+    heap->errors = 0;
+#endif
+    clearheap(heap);
+    heap->generation = newgeneration();
+    heap->policy = BUDDY_POLICY_FIRSTFIT;
+    heap->purgelevel = -1;
+    heap->purge = 0;
+    heap->purgearg = 0;
+#ifdef BUDDY_TRACE
+    heap->trace = 0;
+#endif
+#ifdef BUDDY_STATS
+    memset(&heap->counters,0,sizeof(heap->counters));
+#endif
+    return 0;
+}
+
+/**
+ *  @brief  coalesce
+ *
+ *  @note   makes the free block k at level l available, merging it with its
+ *          buddy while the buddy is available. It stops at the first busy buddy.
+ *
+ *  @note   When the result has at least the purge size, the block of that size
+ *          (or larger) with the freed one is purged. The other blocks merged were
+ *          purged when they were formed, or were never used.
+ */
+static void
+coalesce(buddy_heap *heap, int k, int l) {
+size_t d;
+int j,m;
+
+    j = k;
+    m = l;
+    while( k > 0 ) {
+        if( takebit(heap->avail,buddyof(k)) == 0 )
+            break;
+        addfree(heap,l,-1);
+        k = parent(k);
+        l--;
+        clearsplit(heap,k);
+    }
+    if( l <= heap->purgelevel ) {
+        // Only the block of the purge size with the freed one may have pages in use
+        d = (size_t) (j-levelfirst(m))*levelsize(heap,m);
+        if( m > heap->purgelevel )
+            m = heap->purgelevel;
+        heap->purge(heap->base+(d&~(levelsize(heap,m)-1)),levelsize(heap,m),heap->purgearg);
+    }
+    setavail(heap,k);
+    addfree(heap,l,1);
+#ifdef BUDDY_ATOMIC
+    // The buddy may have been freed without lock meanwhile
+    if( (l == heap->leaflevel) && testbit(heap->avail,buddyof(k)) )
+        (void) BV_ATOMIC_XCHG(&heap->pending,1);
+#endif
+}
+
+#ifdef BUDDY_LAZY
+/**
+ *  @brief  drainlazy
+ *
+ *  @note   merges the n oldest blocks of the list of order o
+ */
+static void
+drainlazy(buddy_heap *heap, int o, int n) {
+int *list = heap->lazy[o];
+int i;
+
+    for(i=0;i<n;i++)
+        coalesce(heap,list[i],heap->leaflevel-o);
+    for(i=n;i<heap->nlazy[o];i++)
+        list[i-n] = list[i];
+    heap->nlazy[o] -= n;
+}
+
+/**
+ *  @brief  mergelazy
+ *
+ *  @note   merges all blocks kept in the lists. Returns their number.
+ */
+static int
+mergelazy(buddy_heap *heap) {
+int o,n;
+
+    n = 0;
+    for(o=0;o<BUDDY_LAZY_LEVELS;o++) {
+        n += heap->nlazy[o];
+        drainlazy(heap,o,heap->nlazy[o]);
+    }
+    return n;
+}
+
+/**
+ *  @brief  buddy_heap_merge
+ *
+ *  @note   merges all blocks kept in the lists, e.g. before taking statistics
+ */
+void
+buddy_heap_merge(buddy_heap *heap) {
+
+    (void) mergelazy(heap);
+}
+#endif
+
+/**
+ *  @brief  release
+ *
+ *  @note   frees the used block k at level l. With BUDDY_LAZY, it is put
+ *          in the list of its level instead of being merged
+ */
+static inline void
+release(buddy_heap *heap, int k, int l) {
+#ifdef BUDDY_LAZY
+int o = heap->leaflevel-l;
+#endif
+
+    clearused(heap,k);
+    countfree(heap,l);
+    RETIRE(heap,k,l);
+#ifdef BUDDY_LAZY
+    if( o < BUDDY_LAZY_LEVELS ) {
+        if( heap->nlazy[o] == BUDDY_LAZY_WATERMARK )
+            drainlazy(heap,o,BUDDY_LAZY_WATERMARK/2);
+        heap->lazy[o][heap->nlazy[o]++] = k;
+        return;
+    }
+#endif
+    coalesce(heap,k,l);
+}
+
+#ifdef BUDDY_ATOMIC
+/**
+ *  @brief  mergeleaves
+ *
+ *  @note   merges the pairs of available leaves left by buddy_heap_free_lockfree.
+ *          Must be called with the lock.
+ */
+static void
+mergeleaves(buddy_heap *heap) {
+int first = heap->mapsize-1;
+int end = 2*heap->mapsize-1;
+int k;
+
+    if( BV_ATOMIC_XCHG(&heap->pending,0) == 0 )
+        return;
+    k = findavail(heap,first,end);
+    while( k >= 0 ) {
+        // Left leaves are odd
+        if( (k&1) && testbit(heap->avail,k+1) && takebit(heap->avail,k) ) {
+            if( takebit(heap->avail,k+1) ) {
+                addfree(heap,heap->leaflevel,-2);
+                clearsplit(heap,parent(k));
+                coalesce(heap,parent(k),heap->leaflevel-1);
+            } else {
+                // Buddy was just taken. Put it back
+                setavail(heap,k);
+                if( testbit(heap->avail,k+1) )
+                    (void) BV_ATOMIC_XCHG(&heap->pending,1);
+            }
+        }
+        k = findavail(heap,k+1,end);
+    }
+}
+#endif
+
+/**
+ *  @brief  Placement policies
+ *
+ *  @note   Each one returns an available block of level l (not taken yet) or -1
+ *          if there is none. They only use the avail bits of the level.
+ */
+///@{
+/// Lowest address
+static inline int
+placefirst(buddy_heap *heap, int l) {
+    return findavail(heap,levelfirst(l),levelfirst(l+1));
+}
+
+/// Highest address
+static inline int
+placelast(buddy_heap *heap, int l) {
+    return findlastavail(heap,levelfirst(l),levelfirst(l+1));
+}
+
+/// Lowest address among the first BUDDY_BESTFIT_PROBES with an allocated buddy
+static int
+placebest(buddy_heap *heap, int l) {
+int first,end,k,n;
+
+    first = findavail(heap,levelfirst(l),levelfirst(l+1));
+    if( first <= 0 )
+        return first;
+    end = levelfirst(l+1);
+    for(k=first,n=0;(k >= 0) && (n < BUDDY_BESTFIT_PROBES);k=findavail(heap,k+1,end),n++) {
+        if( isused(heap,buddyof(k)) )
+            return k;
+    }
+    return first;
+}
+///@}
+
+/**
+ *  @brief  takeblock
+ *
+ *  @note   takes an available block of the nearest level at or above level
+ *          (i.e., with the same number or lower), chosen by the policy of the
+ *          heap. Returns the node (and its level in *lp) or -1 if there is none.
+ *
+ *  @note   With BUDDY_POLICY_ADDRESS, it takes the block with the lowest address
+ *          at any level at or above level, which may be larger than the nearest.
+ */
+static int
+takeblock(buddy_heap *heap, int level, int *lp) {
+int k,l,m,a,best;
+
+    for(;;) {
+        k = -1;
+        l = level;
+        if( heap->policy == BUDDY_POLICY_ADDRESS ) {
+            // The first block of each level is compared by its first leaf
+            best = -1;
+            for(m=level;m>=0;m--) {
+                if( getfree(heap,m) <= 0 )
+                    continue;
+                a = placefirst(heap,m);
+                if( a < 0 )
+                    continue;
+                a = (a-levelfirst(m))<<(level-m);
+                if( (best < 0) || (a < best) ) {
+                    best = a;
+                    l = m;
+                }
+            }
+            if( best >= 0 )
+                k = levelfirst(l)+(best>>(level-l));
+        } else {
+            for(l=level;l>=0;l--) {
+                if( getfree(heap,l) <= 0 )
+                    continue;
+                if( heap->policy == BUDDY_POLICY_TOPDOWN )
+                    k = placelast(heap,l);
+                else if( heap->policy == BUDDY_POLICY_BESTFIT )
+                    k = placebest(heap,l);
+                else
+                    k = placefirst(heap,l);
+                if( k >= 0 )
+                    break;
+            }
+        }
+        if( k < 0 )
+            return -1;
+        // A leaf can be taken by buddy_heap_alloc_lockfree meanwhile. Then look again
+        if( takebit(heap->avail,k) ) {
+            addfree(heap,l,-1);
+            *lp = l;
+            return k;
+        }
+    }
+}
+
+/**
+ *  @brief  allocatlevel
+ *
+ *  @note   allocates a block of level for a request of size bytes
+ */
+static void *
+allocatlevel(buddy_heap *heap, int level, size_t size) {
+int k;
+int l;
+
+#ifdef BUDDY_LAZY
+    // Last block of this size freed
+    l = heap->leaflevel-level;
+    if( (l < BUDDY_LAZY_LEVELS) && (heap->nlazy[l] > 0) ) {
+        k = heap->lazy[l][--heap->nlazy[l]];
+        setused(heap,k);
+        countalloc(heap,level,size,1);
+        return blockaddr(heap,k,level);
+    }
+#endif
+
+#ifdef BUDDY_ATOMIC
+    if( level < heap->leaflevel )
+        mergeleaves(heap);
+#endif
+
+    // Nearest level with a free block
+    k = takeblock(heap,level,&l);
+#ifdef BUDDY_LAZY
+    if( (k < 0) && (mergelazy(heap) > 0) )
+        k = takeblock(heap,level,&l);
+#endif
+    if( k < 0 ) {
+        countfail(heap);
+        return 0;
+    }
+
+    // Split it down. Left halves are taken, right halves are available
+    while( l < level ) {
+        setsplit(heap,k);
+        k = leftchild(k);
+        l++;
+        setavail(heap,k+1);
+        addfree(heap,l,1);
+    }
+    // reserve it
+    setused(heap,k);
+    countalloc(heap,l,size,1);
+    return blockaddr(heap,k,l);
+}
+
+/**
+ *  @brief  allocblock
+ *
+ *  @note   buddy_heap_alloc without the trace
+ */
+static void *
+allocblock(buddy_heap *heap, size_t size) {
+
+    // Too big?
+    if( size > heap->size ) {
+        countfail(heap);
+        return 0;
+    }
+    return allocatlevel(heap,sizelevel(heap,size),size);
+}
+
+/**
+ *  @brief  buddy_heap_alloc
+ */
+void *
+buddy_heap_alloc(buddy_heap *heap, size_t size) {
+void *p;
+
+    p = allocblock(heap,size);
+    GUARD(heap,p,size);
+    TRACE(heap,ALLOC,size,p,0,0);
+    return p;
+}
+
+/**
+ *  @brief  allocaligned
+ *
+ *  @note   buddy_heap_alloc_aligned without the trace
+ *
+ *  @note   returns a block of at least size bytes whose address is a multiple
+ *          of align (a power of 2) or 0 if there is none.
+ *
+ *  @note   The blocks of a level start at multiples of their size from base, so
+ *          when base is aligned and align is not larger than the block, any block
+ *          will do. Otherwise the block must start at a displacement d with
+ *          d = t (mod align), where base+t is aligned. There is none when t is not
+ *          a multiple of the size. A free block of a level above can be used when
+ *          it contains such a d, and it is split down towards it.
+ */
+static void *
+allocaligned(buddy_heap *heap, size_t size, size_t align) {
+size_t t,a,d,s;
+int level;
+int first,end;
+int k,l;
+
+    if( align <= 1 )
+        return allocblock(heap,size);
+    if( !ispowerof2(align) || (size > heap->size) ) {
+        countfail(heap);
+        return 0;
+    }
+
+    level = sizelevel(heap,size);
+    t = (0-(uintptr_t) heap->base)&(align-1);
+    if( (t == 0) && (align <= levelsize(heap,level)) )
+        return allocblock(heap,size);
+    if( t&(levelsize(heap,level)-1) ) {
+        countfail(heap);
+        return 0;
+    }
+
+#ifdef BUDDY_ATOMIC
+    if( level < heap->leaflevel )
+        mergeleaves(heap);
+#endif
+
+    // Nearest level with a free block containing an aligned address
+    d = 0;
+    k = -1;
+    for(l=level;l>=0;l--) {
+        if( getfree(heap,l) <= 0 )
+            continue;
+        s = levelsize(heap,l);
+        first = levelfirst(l);
+        end = levelfirst(l+1);
+        for(k=findavail(heap,first,end);k>=0;k=findavail(heap,k+1,end)) {
+            a = (size_t) (k-first)*s;
+            d = a+((t-a)&(align-1));
+            if( (d-a < s) && takebit(heap->avail,k) )
+                break;
+        }
+        if( k >= 0 )
+            break;
+    }
+    if( l < 0 ) {
+#ifdef BUDDY_LAZY
+        if( mergelazy(heap) > 0 )
+            return allocaligned(heap,size,align);
+#endif
+        countfail(heap);
+        return 0;
+    }
+    addfree(heap,l,-1);
+
+    // Split it down towards d. The other halves are available
+    while( l < level ) {
+        setsplit(heap,k);
+        k = leftchild(k);
+        l++;
+        if( (d/levelsize(heap,l))&1 ) {
+            setavail(heap,k);
+            k++;
+        } else {
+            setavail(heap,k+1);
+        }
+        addfree(heap,l,1);
+    }
+    setused(heap,k);
+    countalloc(heap,l,size,1);
+    return blockaddr(heap,k,l);
+}
+
+/**
+ *  @brief  buddy_heap_alloc_level
+ *
+ *  @note   allocates a block of level (leaflevel for the minimal size, 0 for the
+ *          whole heap) for a request of size bytes, that is only counted. For
+ *          callers that know the level of their requests, as buddy.hpp, that
+ *          computes it at compile time. Returns 0 if level is not valid.
+ */
+void *
+buddy_heap_alloc_level(buddy_heap *heap, int level, size_t size) {
+void *p;
+
+    if( (level < 0) || (level > heap->leaflevel) || (size > heap->size) ) {
+        countfail(heap);
+        return 0;
+    }
+    p = allocatlevel(heap,level,size);
+    GUARD(heap,p,size);
+    TRACE(heap,ALLOC,size,p,0,0);
+    return p;
+}
+
+/**
+ *  @brief  buddy_heap_alloc_aligned
+ */
+void *
+buddy_heap_alloc_aligned(buddy_heap *heap, size_t size, size_t align) {
+void *p;
+
+    p = allocaligned(heap,size,align);
+    GUARD(heap,p,size);
+    TRACE(heap,ALLOC,size,p,0,align);
+    return p;
+}
+
+/**
+ *  @brief  leafof
+ *
+ *  @note   returns the leaf corresponding to addr or -1 if addr is not the
+ *          start of a block in this heap
+ */
+static inline int
+leafof(buddy_heap *heap, void *addr) {
+size_t disp = (char *) addr - heap->base;
+
+    if( ((char *) addr < heap->base) || (disp >= heap->size) )
+        return -1;
+    if( disp&(heap->minsize-1) )
+        return -1;
+    return (int) (disp>>heap->minshift);
+}
+
+/**
+ *  @brief  findblock
+ *
+ *  @note   returns the used node of the block starting at leaf d (and its
+ *          level in *level) or -1 if there is none.
+ *
+ *  @note   The block starts at leaf d, so it can only be at the levels where
+ *          d is a multiple of the number of leaves of a block. Only these
+ *          levels are searched, from the leaf up. With BUDDY_ORDERMAP, the
+ *          level is read from the map, and only blocks of BUDDY_ORDERMAX or
+ *          more are searched, from that order up.
+ */
+static int
+findblock(buddy_heap *heap, int d, int *level) {
+int k,l,top;
+#ifdef BUDDY_ORDERMAP
+int o;
+#endif
+
+    // Highest level where a block can start at leaf d
+    top = d ? heap->leaflevel-bv_ctz(d) : 0;
+
+#ifdef BUDDY_ORDERMAP
+    o = getorder(heap,d)-1;
+    if( (o < 0) || (d&((1<<o)-1)) )
+        return -1;
+    l = heap->leaflevel-o;
+    k = levelfirst(l)+(d>>o);
+    if( o < BUDDY_ORDERMAX ) {
+        if( isused(heap,k) == 0 )
+            return -1;
+        *level = l;
+        return k;
+    }
+#else
+    k = heap->mapsize+d-1;
+    l = heap->leaflevel;
+#endif
+    while( isused(heap,k) == 0 ) {
+        if( l == top )
+            return -1;
+        k = parent(k);
+        l--;
+    }
+    *level = l;
+    return k;
+}
+
+/**
+ *  @brief  freeblock
+ *
+ *  @note   buddy_heap_free without the trace. Returns -1 when addr is not
+ *          allocated (after the report), 0 otherwise
+ */
+static int
+freeblock(buddy_heap *heap, void *addr) {
+int d,k,l;
+
+    d = leafof(heap,addr);
+    if( (d < 0) || ((k = findblock(heap,d,&l)) < 0) ) {
+        // Not allocated
+        REPORT(heap,BUDDY_ERROR_INVALID,addr);
+        return -1;
+    }
+    release(heap,k,l);
+    return 0;
+}
+
+/**
+ *  @brief  buddy_heap_free
+ *
+ *  @note   only the frees that are accepted are traced
+ */
+void
+buddy_heap_free(buddy_heap *heap, void *addr) {
+
+    if( freeblock(heap,addr) == 0 )
+        TRACE(heap,FREE,0,addr,0,0);
+}
+
+/**
+ *  @brief  buddy_heap_usable_size
+ *
+ *  @note   returns the size of the allocated block starting at addr or 0 if
+ *          there is none
+ */
+size_t
+buddy_heap_usable_size(buddy_heap *heap, void *addr) {
+int d,l;
+
+    d = leafof(heap,addr);
+    if( (d < 0) || (findblock(heap,d,&l) < 0) )
+        return 0;
+    return levelsize(heap,l);
+}
+
+/**
+ *  @brief  freeatlevel
+ *
+ *  @note   frees the block at leaf d, of level l if it is used. Otherwise the
+ *          block is searched, as the level does not match. Returns -1 when
+ *          addr is not allocated, as freeblock
+ */
+static inline int
+freeatlevel(buddy_heap *heap, void *addr, int d, int l) {
+int k;
+
+    // A block of level l starts at a multiple of its number of leaves
+    k = levelfirst(l)+(d>>(heap->leaflevel-l));
+    if( (d&((1<<(heap->leaflevel-l))-1)) || (isused(heap,k) == 0) ) {
+#ifdef BUDDY_CHECKED
+        if( findblock(heap,d,&l) >= 0 )
+            report(heap,BUDDY_ERROR_SIZE,addr);
+#endif
+        return freeblock(heap,addr);
+    }
+    release(heap,k,l);
+    return 0;
+}
+
+/**
+ *  @brief  buddy_heap_free_sized
+ *
+ *  @note   size must be the one used in the allocation (or any size that
+ *          rounds to the same block). The node is found without searching.
+ *          When size does not match, or addr is not the start of a block of
+ *          that size, it falls back to buddy_heap_free.
+ */
+void
+buddy_heap_free_sized(buddy_heap *heap, void *addr, size_t size) {
+int d;
+
+    d = leafof(heap,addr);
+    if( (d < 0) || (size > heap->size) ) {
+        REPORT(heap,BUDDY_ERROR_INVALID,addr);
+        return;
+    }
+    if( freeatlevel(heap,addr,d,sizelevel(heap,size)) == 0 )
+        TRACE(heap,FREE,size,addr,0,0);
+}
+
+/**
+ *  @brief  buddy_heap_free_level
+ *
+ *  @note   frees the block at addr allocated from level, as buddy_heap_free_sized
+ */
+void
+buddy_heap_free_level(buddy_heap *heap, void *addr, int level) {
+int d;
+
+    d = leafof(heap,addr);
+    if( (d < 0) || (level < 0) || (level > heap->leaflevel) ) {
+        REPORT(heap,BUDDY_ERROR_INVALID,addr);
+        return;
+    }
+    if( freeatlevel(heap,addr,d,level) == 0 )
+        TRACE(heap,FREE,levelsize(heap,level),addr,0,0);
+}
+
+/**
+ *  @brief  reallocblock
+ *
+ *  @note   buddy_heap_realloc without the trace: changes the size of the block at addr and returns its new address
+ *          or 0 if there is no room (then the block is kept). As realloc, a null
+ *          addr allocates and a zero size frees.
+ *
+ *  @note   A smaller block is taken by splitting the block and making the right
+ *          halves available. A larger block is taken by merging the block with
+ *          its buddies while they are available, up to the new level; the data
+ *          is moved down when the block was not the first one. Only when some
+ *          buddy is not available, a new block is allocated and the data copied.
+ */
+static void *
+reallocblock(buddy_heap *heap, void *addr, size_t size) {
+int d,k,l,level;
+int i,j;
+size_t n;
+char *p;
+
+    if( addr == 0 )
+        return allocblock(heap,size);
+    if( size == 0 ) {
+        freeblock(heap,addr);
+        return 0;
+    }
+    d = leafof(heap,addr);
+    if( (d < 0) || ((k = findblock(heap,d,&l)) < 0) ) {
+        REPORT(heap,BUDDY_ERROR_INVALID,addr);
+        return 0;
+    }
+    if( size > heap->size ) {
+        countfail(heap);
+        return 0;
+    }
+    // The trailer is checked (and its guard bit dropped) only once the block
+    // is resized or copied; when there is no room it is kept as it was
+    level = sizelevel(heap,size);
+    if( level == l ) {
+        CHECKTRAILER(heap,k,l);
+        return addr;
+    }
+
+    if( level > l ) {
+        // Shrink. Left halves are kept, right halves are available
+        CHECKTRAILER(heap,k,l);
+        clearused(heap,k);
+        countfree(heap,l);
+        while( l < level ) {
+            setsplit(heap,k);
+            k = leftchild(k);
+            l++;
+            if( l <= heap->purgelevel )
+                heap->purge(blockaddr(heap,k+1,l),levelsize(heap,l),heap->purgearg);
+            setavail(heap,k+1);
+            addfree(heap,l,1);
+        }
+        setused(heap,k);
+        countalloc(heap,l,size,1);
+        return addr;
+    }
+
+#ifdef BUDDY_ATOMIC
+    if( level < heap->leaflevel )
+        mergeleaves(heap);
+#endif
+    // Grow in place if all buddies up to the new level are available
+    for(i=k,j=l;j>level;i=parent(i),j--) {
+        if( !testbit(heap->avail,buddyof(i)) )
+            break;
+    }
+    // Only the first buddy can be a leaf, taken meanwhile by buddy_heap_alloc_lockfree
+    if( (j == level) && takebit(heap->avail,buddyof(k)) ) {
+        n = levelsize(heap,l);
+        CHECKTRAILER(heap,k,l);
+        clearused(heap,k);
+        countfree(heap,l);
+        for(;;) {
+            addfree(heap,l,-1);
+            k = parent(k);
+            l--;
+            clearsplit(heap,k);
+            if( l == level )
+                break;
+            (void) takebit(heap->avail,buddyof(k));
+        }
+        setused(heap,k);
+        countalloc(heap,l,size,1);
+        p = blockaddr(heap,k,l);
+        if( p != (char *) addr )
+            memmove(p,addr,n);
+        return p;
+    }
+
+    p = allocblock(heap,size);
+    if( p == 0 )
+        return 0;
+    memcpy(p,addr,levelsize(heap,l));
+    release(heap,k,l);                      // checks the trailer
+    return p;
+}
+
+/**
+ *  @brief  buddy_heap_realloc
+ */
+void *
+buddy_heap_realloc(buddy_heap *heap, void *addr, size_t size) {
+void *p;
+
+    p = reallocblock(heap,addr,size);
+    GUARD(heap,p,size);
+    TRACE(heap,REALLOC,size,p,addr,0);
+    return p;
+}
+
+/**
+ *  @brief  fill
+ *
+ *  @note   allocates all blocks at level to of the subtree of the free block k
+ *          at level l. The nodes in between are marked split, level by level.
+ *          The addresses are stored in out. Returns the number of blocks.
+ */
+static int
+fill(buddy_heap *heap, int k, int l, int to, void **out) {
+int i,n,start;
+size_t s;
+char *a;
+
+    for(i=l;i<to;i++) {
+        start = levelfirst(i)+((k-levelfirst(l))<<(i-l));
+        splitrange(heap,start,start+(1<<(i-l)));
+    }
+    n = 1<<(to-l);
+    start = levelfirst(to)+((k-levelfirst(l))<<(to-l));
+    usedrange(heap,start,start+n);
+
+    a = blockaddr(heap,k,l);
+    s = levelsize(heap,to);
+    for(i=0;i<n;i++)
+        out[i] = a+i*s;
+    return n;
+}
+
+/**
+ *  @brief  carve
+ *
+ *  @note   allocates the first m blocks at level to inside the free block k at
+ *          level l (m must not be larger than the number of blocks there). The
+ *          halves that are not needed become available.
+ */
+static void
+carve(buddy_heap *heap, int k, int l, int to, int m, void **out) {
+int c;
+
+    c = 1<<(to-l);
+    while( m < c ) {
+        setsplit(heap,k);
+        k = leftchild(k);
+        l++;
+        c /= 2;
+        if( m > c ) {
+            // Left half is used as a whole. Continue on right half
+            out += fill(heap,k,l,to,out);
+            m -= c;
+            k++;
+        } else {
+            setavail(heap,k+1);
+            addfree(heap,l,1);
+        }
+    }
+    fill(heap,k,l,to,out);
+}
+
+/**
+ *  @brief  allocbulk
+ *
+ *  @note   buddy_heap_alloc_bulk without the trace: allocates up to count blocks of size bytes. The available blocks
+ *          of this size are taken first, then larger blocks are split once and
+ *          all their halves are used. Returns the number of blocks allocated.
+ */
+static int
+allocbulk(buddy_heap *heap, size_t size, int count, void **out) {
+int level;
+int k,l,m,n,c;
+#ifdef BUDDY_LAZY
+int o;
+#endif
+
+    if( (size > heap->size) || (count <= 0) )
+        return 0;
+
+    level = sizelevel(heap,size);
+#ifdef BUDDY_ATOMIC
+    if( level < heap->leaflevel )
+        mergeleaves(heap);
+#endif
+
+    n = 0;
+#ifdef BUDDY_LAZY
+    // Blocks of this size freed last
+    o = heap->leaflevel-level;
+    while( (o < BUDDY_LAZY_LEVELS) && (n < count) && (heap->nlazy[o] > 0) ) {
+        k = heap->lazy[o][--heap->nlazy[o]];
+        setused(heap,k);
+        out[n++] = blockaddr(heap,k,level);
+    }
+#endif
+
+    // Blocks already available
+    k = findavail(heap,levelfirst(level),levelfirst(level+1));
+    while( (n < count) && (k >= 0) ) {
+        if( takebit(heap->avail,k) ) {
+            addfree(heap,level,-1);
+            setused(heap,k);
+            out[n++] = blockaddr(heap,k,level);
+        }
+        k = findavail(heap,k+1,levelfirst(level+1));
+    }
+
+    // Split larger blocks
+    while( (n < count) && (level > 0) ) {
+        k = takeblock(heap,level-1,&l);
+        if( k < 0 )
+            break;
+        c = 1<<(level-l);
+        m = count-n < c ? count-n : c;
+        carve(heap,k,l,level,m,out+n);
+        n += m;
+    }
+    countalloc(heap,level,size,n);
+#ifdef BUDDY_LAZY
+    if( (n < count) && (mergelazy(heap) > 0) )
+        return n+allocbulk(heap,size,count-n,out+n);
+#endif
+    if( n < count )
+        countfail(heap);
+    return n;
+}
+
+/**
+ *  @brief  buddy_heap_alloc_bulk
+ */
+int
+buddy_heap_alloc_bulk(buddy_heap *heap, size_t size, int count, void **out) {
+int i,n;
+
+    n = allocbulk(heap,size,count,out);
+    for(i=0;i<n;i++) {
+        GUARD(heap,out[i],size);
+        TRACE(heap,ALLOC,size,out[i],0,0);
+    }
+    return n;
+}
+
+/**
+ *  @brief  inside
+ *
+ *  @note   returns a non zero value if leaf d is inside block k at level l
+ */
+static inline int
+inside(buddy_heap *heap, int d, int k, int l) {
+    return (d>>(heap->leaflevel-l)) == (k-levelfirst(l));
+}
+
+/**
+ *  @brief  compareaddr
+ */
+static int
+compareaddr(const void *a, const void *b) {
+char *x = *(char * const *) a;
+char *y = *(char * const *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  buddy_heap_free_bulk
+ *
+ *  @note   frees count blocks. ptrs is sorted in place by address. Buddies
+ *          freed together are merged directly, without making each one available.
+ *
+ *  @note   A stack holds the freed blocks that can still be merged with the
+ *          following ones, i.e., left halves whose buddy contains the next
+ *          block. It holds at most one block per level.
+ */
+void
+buddy_heap_free_bulk(buddy_heap *heap, void **ptrs, int count) {
+int stack[BUDDY_MAXLEVELS+1];
+int levels[BUDDY_MAXLEVELS+1];
+int sp,i,d,k,l,t;
+
+    if( count <= 0 )
+        return;
+    qsort(ptrs,count,sizeof(void *),compareaddr);
+
+    sp = 0;
+    for(i=0;i<count;i++) {
+        d = leafof(heap,ptrs[i]);
+        if( (d < 0) || ((k = findblock(heap,d,&l)) < 0) ) {
+            REPORT(heap,BUDDY_ERROR_INVALID,ptrs[i]);
+            continue;
+        }
+        TRACE(heap,FREE,0,ptrs[i],0,0);
+        clearused(heap,k);
+        countfree(heap,l);
+        RETIRE(heap,k,l);
+
+        // Blocks that can not be merged with this one
+        while( sp > 0 ) {
+            t = stack[sp-1];
+            if( (t&1) && inside(heap,d,t+1,levels[sp-1]) )
+                break;
+            sp--;
+            coalesce(heap,t,levels[sp]);
+        }
+
+        stack[sp] = k;
+        levels[sp] = l;
+        sp++;
+        // Merge buddies on top of stack
+        while( (sp > 1) && (levels[sp-1] == levels[sp-2]) && (stack[sp-2] == buddyof(stack[sp-1])) ) {
+            sp--;
+            k = parent(stack[sp]);
+            clearsplit(heap,k);
+            stack[sp-1] = k;
+            levels[sp-1]--;
+        }
+    }
+    while( sp > 0 ) {
+        sp--;
+        coalesce(heap,stack[sp],levels[sp]);
+    }
+}
+
+/**
+ *  @brief  buddy_heap_setpolicy
+ *
+ *  @note   sets the placement policy of the heap. Returns the previous one or
+ *          -1 if policy is not valid.
+ */
+int
+buddy_heap_setpolicy(buddy_heap *heap, int policy) {
+int old = heap->policy;
+
+    if( (policy < BUDDY_POLICY_FIRSTFIT) || (policy > BUDDY_POLICY_TOPDOWN) )
+        return -1;
+    heap->policy = policy;
+    return old;
+}
+
+/**
+ *  @brief  buddy_heap_setpurge
+ *
+ *  @note   calls purge(addr,size,arg) for each free block of at least size bytes
+ *          formed by a free (and for the whole area after a reset), before it
+ *          can be allocated again. The block freed is purged once: when it is
+ *          merged with larger free blocks, only the block of size bytes with it
+ *          is given. Blocks already free are not purged, so it should be set
+ *          before the first allocation. A null purge disables it.
+ *
+ *  @note   returns 0 if OK or -1 if size is larger than the area
+ */
+int
+buddy_heap_setpurge(buddy_heap *heap, size_t size, buddy_purgefn purge, void *arg) {
+
+    if( size > levelsize(heap,0) )
+        return -1;
+    heap->purgelevel = purge ? sizelevel(heap,size) : -1;
+    heap->purge = purge;
+    heap->purgearg = arg;
+    return 0;
+}
+
+#ifdef BUDDY_CHECKED
+/**
+ *  @brief  buddy_heap_seterror
+ *
+ *  @note   sets the routine called with each error found (0 to only count them
+ *          in heap->errors), e.g. to abort or to log the stack of the caller
+ */
+void
+buddy_heap_seterror(buddy_heap *heap, buddy_errorfn error, void *arg) {
+
+    heap->error = error;
+    heap->errorarg = arg;
+}
+#endif
+
+#ifdef BUDDY_TRACE
+/**
+ *  @brief  buddy_heap_settrace
+ *
+ *  @note   records the operations of heap in trace (0 stops the trace)
+ */
+void
+buddy_heap_settrace(buddy_heap *heap, struct buddy_trace *trace) {
+
+    heap->trace = trace;
+}
+#endif
+
+#ifdef BUDDY_LAZY
+/**
+ *  @brief  droplazy
+ *
+ *  @note   removes from the lists the blocks inside block k at level l.
+ *          Returns their size in bytes.
+ */
+static size_t
+droplazy(buddy_heap *heap, int k, int l) {
+size_t bytes;
+int o,m,i,n;
+
+    bytes = 0;
+    for(o=0;o<BUDDY_LAZY_LEVELS;o++) {
+        m = heap->leaflevel-o;
+        if( m < l )
+            break;
+        n = 0;
+        for(i=0;i<heap->nlazy[o];i++) {
+            if( ((heap->lazy[o][i]+1)>>(m-l)) == k+1 )
+                bytes += levelsize(heap,m);
+            else
+                heap->lazy[o][n++] = heap->lazy[o][i];
+        }
+        heap->nlazy[o] = n;
+    }
+    return bytes;
+}
+#endif
+
+/**
+ *  @brief  buddy_heap_free_subtree
+ *
+ *  @note   frees all blocks inside the block of size bytes at addr, allocated
+ *          or not, e.g. all allocations of a frame made in a block reserved for
+ *          them. addr must be aligned to the size of the block (relative to the
+ *          base) and the block must not be inside a larger block, allocated or
+ *          free. Returns 0 if OK or -1 otherwise.
+ *
+ *  @note   The bits of the nodes below the block are cleared level by level, a
+ *          range at a time (a word or a chunk at a time, except with
+ *          BUDDY_BLOCKED or BUDDY_ATOMIC), without visiting the allocations.
+ *          Then the block is made available and merged with its buddy.
+ *          With BUDDY_STATS, the blocks in use are counted as frees of their
+ *          order from the used bits of each range.
+ */
+int
+buddy_heap_free_subtree(buddy_heap *heap, void *addr, size_t size) {
+size_t bytes;
+int d,k,l,m,j,n,first,end,leaves;
+
+    d = leafof(heap,addr);
+    if( (d < 0) || (size > levelsize(heap,0)) )
+        return -1;
+    l = sizelevel(heap,size);
+    if( d&((1<<(heap->leaflevel-l))-1) )
+        return -1;              // Not aligned
+    k = levelfirst(l)+(d>>(heap->leaflevel-l));
+    for(j=k;j>0;) {
+        j = parent(j);
+        if( issplit(heap,j) == 0 )
+            return -1;          // Inside a larger block
+    }
+    TRACE(heap,SUBTREE,size,addr,0,0);
+
+    bytes = 0;
+#ifdef BUDDY_LAZY
+    bytes += droplazy(heap,k,l);
+#endif
+    leaves = (int) (heap->size>>heap->minshift);
+    for(m=l;m<=heap->leaflevel;m++) {
+        first = levelfirst(m)+((k-levelfirst(l))<<(m-l));
+        end = first+(1<<(m-l));
+        n = bv_countrange(heap->avail,first,end);
+        if( n ) {
+            clearrange(heap->avail,first,end);
+            addfree(heap,m,-n);
+            bytes += n*levelsize(heap,m);
+        }
+#ifdef BUDDY_STATS
+        // The blocks in use, without those after the end of the area
+        n = levelfirst(m)+((leaves+(1<<(heap->leaflevel-m))-1)>>(heap->leaflevel-m));
+        if( first < n )
+            countfrees(heap,m,countused(heap,first,end < n ? end : n));
+#endif
+        freerange(heap,first,end);
+    }
+    clearorders(heap,d,1<<(heap->leaflevel-l));
+
+    if( d+(1<<(heap->leaflevel-l)) <= leaves ) {
+        coalesce(heap,k,l);
+    } else {
+        // Blocks beyond the end of the area are not in use
+        bytes += (size_t) (d+(1<<(heap->leaflevel-l))-leaves)<<heap->minshift;
+        if( l <= heap->purgelevel )
+            heap->purge(addr,(size_t) (leaves-d)<<heap->minshift,heap->purgearg);
+        cuttail(heap,k,l,leaves);
+    }
+#ifdef BUDDY_STATS
+    STATADD(heap->counters.inuse,-(levelsize(heap,l)-bytes));
+#else
+    (void) bytes;
+#endif
+    return 0;
+}
+
+/**
+ *  @brief  buddy_heap_reset
+ *
+ *  @note   frees all blocks of the heap and returns its new generation. Front
+ *          ends that keep blocks of the heap can compare the generation with
+ *          the one of their blocks to know that they are gone.
+ *
+ *  @note   The bit vectors are cleared a word (or a chunk) at a time, as in
+ *          buddy_heap_init. Counters other than the bytes in use are kept.
+ */
+unsigned
+buddy_heap_reset(buddy_heap *heap) {
+
+    TRACE(heap,RESET,0,0,0,0);
+    clearheap(heap);
+    if( heap->purge )
+        heap->purge(heap->base,heap->size,heap->purgearg);
+#ifdef BUDDY_STATS
+    heap->counters.inuse = 0;
+#endif
+    heap->generation = newgeneration();
+    return heap->generation;
+}
+
+/**
+ *  @brief  clearbelow
+ *
+ *  @note   clears the used and split bits of the nodes below node k at level l,
+ *          and the order map of its leaves (so the one of k too)
+ */
+static void
+clearbelow(buddy_heap *heap, int k, int l) {
+int m,first;
+
+    for(m=l+1;m<=heap->leaflevel;m++) {
+        first = levelfirst(m)+((k-levelfirst(l))<<(m-l));
+        freerange(heap,first,first+(1<<(m-l)));
+    }
+    clearorders(heap,(k-levelfirst(l))<<(heap->leaflevel-l),1<<(heap->leaflevel-l));
+}
+
+#ifdef BUDDY_LAZY
+/**
+ *  @brief  inlazy
+ *
+ *  @note   returns 1 if the block k at level l is in a lazy list
  */
+static int
+inlazy(buddy_heap *heap, int k, int l) {
+int o = heap->leaflevel-l;
+int i;
 
-#include <stdint.h>
-#ifdef DEBUG
-#include <stdio.h>
-#include <string.h>
+    if( o >= BUDDY_LAZY_LEVELS )
+        return 0;
+    for(i=0;i<heap->nlazy[o];i++) {
+        if( heap->lazy[o][i] == k )
+            return 1;
+    }
+    return 0;
+}
 #endif
 
+/**
+ *  @brief  State of a check of the tree
+ */
+typedef struct {
+    int         errors;                     ///< inconsistencies found
+    int         leaves;                     ///< leaves inside the area
+    int         nused;                      ///< used bits of the nodes visited
+    int         nsplit;                     ///< split bits of the nodes visited
+    int         nlazy;                      ///< blocks of the lazy lists found
+    int         navail[BUDDY_MAXLEVELS];    ///< available blocks found per level
+    size_t      inuse;                      ///< bytes in allocated blocks
+} checkstate;
 
-#include "bitvector.h"
-#include "buddy.h"
+/**
+ *  @brief  checknode
+ *
+ *  @note   checks the subtree of node k at level l, visiting the nodes that are
+ *          reached through split nodes. Returns 1 if it is a free block.
+ */
+static int
+checknode(buddy_heap *heap, checkstate *cs, int k, int l) {
+int a = (k-levelfirst(l))<<(heap->leaflevel-l);
+int s = 1<<(heap->leaflevel-l);
+int u,sp,av,lz,fl,fr;
+
+    u = isused(heap,k) != 0;
+    sp = issplit(heap,k) != 0;
+    av = testbit(heap->avail,k) != 0;
+    cs->nused += u;
+    cs->nsplit += sp;
+    if( a >= cs->leaves ) {
+        // Beyond the end of the area
+        cs->errors += !u || sp || av;
+        return 0;
+    }
+    if( u ) {
+        cs->errors += sp || av || (a+s > cs->leaves);
+#ifdef BUDDY_ORDERMAP
+        cs->errors += getorder(heap,a) != ordercode(heap,l);
+#endif
+        cs->inuse += levelsize(heap,l);
+        return 0;
+    }
+    if( sp ) {
+        if( av || (l == heap->leaflevel) ) {
+            cs->errors++;
+            return 0;
+        }
+        fl = checknode(heap,cs,leftchild(k),l+1);
+        fr = checknode(heap,cs,leftchild(k)+1,l+1);
+        if( fl && fr ) {
+            // Free buddies are merged, except after a free without lock or in a lazy list
+#ifdef BUDDY_ATOMIC
+            if( (l+1 == heap->leaflevel) && testbit(heap->avail,leftchild(k)) &&
+                testbit(heap->avail,leftchild(k)+1) )
+                return 0;
+#endif
+#ifdef BUDDY_LAZY
+            if( inlazy(heap,leftchild(k),l+1) || inlazy(heap,leftchild(k)+1,l+1) )
+                return 0;
+#endif
+            cs->errors++;
+        }
+        return 0;
+    }
+#ifdef BUDDY_LAZY
+    lz = inlazy(heap,k,l);
+#else
+    lz = 0;
+#endif
+    // A free block is available or in a lazy list
+    cs->nlazy += lz;
+    cs->errors += (av == lz) || (a+s > cs->leaves);
+    cs->navail[l] += av;
+    return 1;
+}
 
 /**
- *  @brief  Definition of map and tree size
-*/
-///@{
+ *  @brief  repairnode
+ *
+ *  @note   rebuilds the subtree of node k at level l. The allocated blocks are
+ *          kept (a node used and split too is kept as allocated), the others
+ *          become free and free buddies are merged. Returns 1 if it is a free
+ *          block, that the caller makes available or merges.
+ */
+static int
+repairnode(buddy_heap *heap, checkstate *cs, int k, int l) {
+int a = (k-levelfirst(l))<<(heap->leaflevel-l);
+int s = 1<<(heap->leaflevel-l);
+int fl,fr;
 
-#define MAPSIZE        (BUDDYTOTALSIZE/BUDDYMINSIZE)    ///< Number of blocks
-#define TREESIZE       (MAPSIZE*2-1)                    ///< Number of elements in the tree
-///@}
+    if( a >= cs->leaves ) {
+        setused(heap,k);
+        clearsplit(heap,k);
+        clearbelow(heap,k,l);
+        return 0;
+    }
+    if( isused(heap,k) && (a+s <= cs->leaves) ) {
+        clearsplit(heap,k);
+        clearbelow(heap,k,l);
+        setused(heap,k);
+        cs->inuse += levelsize(heap,l);
+        return 0;
+    }
+    if( !isused(heap,k) && issplit(heap,k) && (l < heap->leaflevel) ) {
+        fl = repairnode(heap,cs,leftchild(k),l+1);
+        fr = repairnode(heap,cs,leftchild(k)+1,l+1);
+        if( fl && fr ) {
+            clearsplit(heap,k);
+            return 1;
+        }
+        if( fl ) {
+            setavail(heap,leftchild(k));
+            addfree(heap,l+1,1);
+        }
+        if( fr ) {
+            setavail(heap,leftchild(k)+1);
+            addfree(heap,l+1,1);
+        }
+        return 0;
+    }
+    clearused(heap,k);
+    clearsplit(heap,k);
+    clearbelow(heap,k,l);
+    if( a+s > cs->leaves ) {
+        // Free block beyond the end of the area
+        cuttail(heap,k,l,cs->leaves);
+        return 0;
+    }
+    return 1;
+}
 
 /**
+ *  @brief  checksummary
  *
+ *  @note   returns the number of elements with set bits whose bit is clear in
+ *          the summary vector above
  */
-///@{
-BV_DECLARE(used,MAPSIZE*2);                  ///< used/free map
-BV_DECLARE(split,MAPSIZE*2);                 ///< already split
-///@}
+static int
+checksummary(buddy_heap *heap) {
+int i,j,n,errors;
+
+    errors = 0;
+    n = BV_SIZE(2*heap->mapsize);
+    for(i=0;i<heap->nsummary;i++) {
+        for(j=0;j<n;j++)
+            errors += (summaryvector(heap,i)[j] != 0) && !testbit(heap->summary[i],j);
+        n = BV_SIZE(n);
+    }
+    return errors;
+}
 
 /**
- *  @brief  Structure used to navigate the allocation tree
+ *  @brief  buddy_heap_check
+ *
+ *  @note   checks the consistency of the bit vectors and counters of heap, e.g.
+ *          after a crash, and returns the number of inconsistencies found. When
+ *          there are some and repair is not 0, the tree is rebuilt from the
+ *          allocated blocks: the free blocks lost are found again, free buddies
+ *          are merged and the lazy lists are emptied. A block being allocated or
+ *          freed at the crash may be kept as allocated, but no allocated block
+ *          is made free.
+ *
+ *  @note   The walk visits the nodes reached through split nodes, so its time
+ *          grows with the number of blocks. The bits of the other nodes are
+ *          checked by counting them, a word at a time.
  */
+int
+buddy_heap_check(buddy_heap *heap, int repair) {
+checkstate cs;
+int l,n;
 
-typedef struct {
-    int         level;      ///< level of node
-    int         index;      ///< index of node
-    int         size;       ///< size of block
-    uint32_t    addr;       ///< address of block
-} nodeinfo;
+    memset(&cs,0,sizeof(cs));
+    cs.leaves = (int) (heap->size>>heap->minshift);
+    (void) checknode(heap,&cs,0,0);
+
+    // No bits on the nodes not visited
+#ifdef BUDDY_BLOCKED
+    l = heap->leaflevel;
+    n = bv_countrange(heap->nodes,0,2*(heap->bandbase[l]+((1<<(l-heap->bandlevel[l]))<<BUDDY_BLOCKHEIGHT)));
+    cs.errors += n != cs.nused+cs.nsplit;
+#else
+    cs.errors += bv_countrange(heap->used,0,2*heap->mapsize-1) != cs.nused;
+    cs.errors += bv_countrange(heap->split,0,2*heap->mapsize-1) != cs.nsplit;
+#endif
+    for(l=0;l<=heap->leaflevel;l++) {
+        n = bv_countrange(heap->avail,levelfirst(l),levelfirst(l+1));
+        cs.errors += (n != cs.navail[l]) + (getfree(heap,l) != cs.navail[l]);
+    }
+    cs.errors += checksummary(heap);
+#ifdef BUDDY_LAZY
+    for(n=0,l=0;l<BUDDY_LAZY_LEVELS;l++)
+        n += heap->nlazy[l];
+    cs.errors += n != cs.nlazy;
+#endif
+#ifdef BUDDY_STATS
+    cs.errors += heap->counters.inuse != cs.inuse;
+#endif
+    if( (cs.errors == 0) || (repair == 0) )
+        return cs.errors;
+
+    n = cs.errors;
+    memset(&cs,0,sizeof(cs));
+    cs.leaves = (int) (heap->size>>heap->minshift);
+    clearavail(heap);
+    for(l=0;l<BUDDY_MAXLEVELS;l++)
+        heap->nfree[l] = 0;
+#ifdef BUDDY_LAZY
+    for(l=0;l<BUDDY_LAZY_LEVELS;l++)
+        heap->nlazy[l] = 0;
+#endif
+#ifdef BUDDY_ATOMIC
+    heap->pending = 0;
+#endif
+    if( repairnode(heap,&cs,0,0) ) {
+        setavail(heap,0);
+        addfree(heap,0,1);
+    }
+#ifdef BUDDY_STATS
+    heap->counters.inuse = cs.inuse;
+#endif
+    return n;
+}
+
+/**
+ *  @brief  imageconfig
+ *
+ *  @note   returns the compile options that change the layout of an image
+ */
+static uint32_t
+imageconfig(void) {
+uint32_t c;
+
+    c = ((uint32_t) (sizeof(buddy_heap)&0xFFFF)<<16)|((uint32_t) sizeof(BV_TYPE)<<8);
+#ifdef BUDDY_BLOCKED
+    c |= 1|(BUDDY_BLOCKHEIGHT<<12);
+#endif
+#ifdef BUDDY_ATOMIC
+    c |= 2;
+#endif
+#ifdef BUDDY_LAZY
+    c |= 4;
+#endif
+#ifdef BUDDY_STATS
+    c |= 8;
+#endif
+#ifdef BUDDY_TRACE
+    c |= 16;
+#endif
+#ifdef BUDDY_CHECKED
+    c |= 32;
+#endif
+#ifdef BUDDY_ORDERMAP
+    c |= 64;
+#endif
+    return c;
+}
+
+/**
+ *  @brief  buddy_heap_format
+ *
+ *  @note   initializes a heap whose structure and metadata are in image, that
+ *          must have BUDDY_IMAGESIZE(size,minsize) bytes, aligned to a cache
+ *          line. Returns the heap (inside image) or 0 if the sizes are not
+ *          valid. The image is attached.
+ */
+buddy_heap *
+buddy_heap_format(void *image, void *base, size_t size, size_t minsize) {
+buddy_image *im = (buddy_image *) image;
+
+    if( buddy_heap_init(&im->heap,base,size,minsize,(char *) image+BUDDY_IMAGEHEADER) < 0 )
+        return 0;
+    memcpy(im->magic,"BUDH",4);
+    im->version = BUDDY_IMAGE_VERSION;
+    im->config = imageconfig();
+#ifdef BUDDY_BLOCKED
+    im->vectors[0] = (uint64_t) ((char *) im->heap.nodes-(char *) image);
+    im->vectors[1] = 0;
+#else
+    im->vectors[0] = (uint64_t) ((char *) im->heap.used-(char *) image);
+    im->vectors[1] = (uint64_t) ((char *) im->heap.split-(char *) image);
+#endif
+    im->vectors[2] = (uint64_t) ((char *) im->heap.avail-(char *) image);
+    im->state = BUDDY_IMAGE_ATTACHED;
+    return &im->heap;
+}
+
+/**
+ *  @brief  buddy_heap_rebase
+ *
+ *  @note   sets the pointers of the heap of an image made by buddy_heap_format
+ *          for the image at its address and the area at base, e.g. in each
+ *          process that maps a shared image. The trace, the purge routine and
+ *          the error routine, that are pointers of a process, are cleared. Returns the heap or 0
+ *          if the image is not valid or was made with other compile options.
+ */
+buddy_heap *
+buddy_heap_rebase(void *image, void *base) {
+buddy_image *im = (buddy_image *) image;
+buddy_heap *heap = &im->heap;
+
+    if( memcmp(im->magic,"BUDH",4) || (im->version != BUDDY_IMAGE_VERSION) ||
+        (im->config != imageconfig()) )
+        return 0;
+    heap->base = (char *) base;
+#ifdef BUDDY_BLOCKED
+    heap->nodes = (bv_type) ((char *) image+im->vectors[0]);
+#else
+    heap->used = (bv_type) ((char *) image+im->vectors[0]);
+    heap->split = (bv_type) ((char *) image+im->vectors[1]);
+#endif
+    heap->avail = (bv_type) ((char *) image+im->vectors[2]);
+    placeextra(heap);
+#ifdef BUDDY_CHECKED
+    heap->error = 0;
+    heap->errorarg = 0;
+#endif
+    heap->purgelevel = -1;
+    heap->purge = 0;
+    heap->purgearg = 0;
+#ifdef BUDDY_TRACE
+    heap->trace = 0;
+#endif
+    return heap;
+}
+
+/**
+ *  @brief  buddy_heap_attach
+ *
+ *  @note   attaches the heap of an image made by buddy_heap_format, that can be
+ *          at another address, with its area at base. Only the pointers of the
+ *          heap are set (buddy_heap_rebase), so it takes a constant time.
+ *
+ *  @note   If the image was not detached (e.g. the process crashed), the heap
+ *          is checked and, with repair, repaired by buddy_heap_check. Returns
+ *          the heap or 0 if the image is not valid, was made with other
+ *          compile options, or is not consistent and repair is 0.
+ */
+buddy_heap *
+buddy_heap_attach(void *image, void *base, int repair) {
+buddy_image *im = (buddy_image *) image;
+buddy_heap *heap;
+
+    heap = buddy_heap_rebase(image,base);
+    if( heap == 0 )
+        return 0;
+    if( (im->state != BUDDY_IMAGE_CLEAN) && buddy_heap_check(heap,repair) && (repair == 0) )
+        return 0;
+    im->state = BUDDY_IMAGE_ATTACHED;
+    return heap;
+}
+
+/**
+ *  @brief  buddy_heap_detach
+ *
+ *  @note   marks the image of heap as detached, so the next attach does not
+ *          check it. The heap must not be used after it. For a mapped file, the
+ *          caller writes the image back (msync) after it.
+ */
+void
+buddy_heap_detach(buddy_heap *heap) {
+buddy_image *im = (buddy_image *) ((char *) heap-offsetof(buddy_image,heap));
+
+    im->state = BUDDY_IMAGE_CLEAN;
+}
+
+#ifdef BUDDY_ATOMIC
+/**
+ *  @brief  buddy_heap_alloc_lockfree
+ *
+ *  @note   returns a block of the minimal size or 0 if there is no available
+ *          leaf. Then buddy_heap_alloc (with the lock) can split a larger block.
+ */
+void *
+buddy_heap_alloc_lockfree(buddy_heap *heap) {
+int first = heap->mapsize-1;
+int end = 2*heap->mapsize-1;
+int k;
+
+    k = findavail(heap,first,end);
+    while( k >= 0 ) {
+        if( takebit(heap->avail,k) ) {
+            addfree(heap,heap->leaflevel,-1);
+            setused(heap,k);
+            countalloc(heap,heap->leaflevel,heap->minsize,1);
+            GUARD(heap,blockaddr(heap,k,heap->leaflevel),heap->minsize);
+            TRACE(heap,ALLOC,heap->minsize,blockaddr(heap,k,heap->leaflevel),0,0);
+            return blockaddr(heap,k,heap->leaflevel);
+        }
+        k = findavail(heap,k+1,end);
+    }
+    TRACE(heap,ALLOC,heap->minsize,0,0,0);
+    return 0;
+}
+
+/**
+ *  @brief  buddy_heap_free_lockfree
+ *
+ *  @note   frees a block of the minimal size. Returns -1 (and does nothing)
+ *          when addr is not one. Then buddy_heap_free must be used.
+ */
+int
+buddy_heap_free_lockfree(buddy_heap *heap, void *addr) {
+int d,k;
+
+    d = leafof(heap,addr);
+    if( d < 0 )
+        return -1;
+    k = heap->mapsize-1+d;
+    if( takeused(heap,k) == 0 )
+        return -1;
+    countfree(heap,heap->leaflevel);
+    RETIRE(heap,k,heap->leaflevel);
+    TRACE(heap,FREE,heap->minsize,addr,0,0);
+    setavail(heap,k);
+    addfree(heap,heap->leaflevel,1);
+    if( testbit(heap->avail,buddyof(k)) )
+        (void) BV_ATOMIC_XCHG(&heap->pending,1);
+    return 0;
+}
+#endif
+
+/**
+ *  @brief  buddy_heap_stats
+ *
+ *  @note   The free space and the largest free block come from the number of
+ *          free blocks per level, so there is no walk over the tree.
+ *
+ *  @note   fragmentation is 1000*(1-largest/free), i.e., 0 when all free
+ *          memory is in one block. internal is 1000*(1-requested/allocated)
+ *          over all allocations, i.e., the waste of rounding to a power of 2.
+ */
+void
+buddy_heap_stats(buddy_heap *heap, buddy_statistics *stats) {
+int l,n;
+
+    stats->size = heap->size;
+    stats->free = 0;
+    stats->largest = 0;
+    for(l=heap->leaflevel;l>=0;l--) {
+        n = getfree(heap,l);
+        if( n <= 0 )
+            continue;
+        stats->free += n*levelsize(heap,l);
+        stats->largest = levelsize(heap,l);
+    }
+#ifdef BUDDY_LAZY
+    // Blocks not merged
+    for(l=0;l<BUDDY_LAZY_LEVELS;l++)
+        stats->free += heap->nlazy[l]*levelsize(heap,heap->leaflevel-l);
+#endif
+    stats->fragmentation = stats->free ? (int) (1000-(stats->largest*1000)/stats->free) : 0;
+#ifdef BUDDY_STATS
+    stats->counters = heap->counters;
+    stats->internal = stats->counters.allocated ?
+        (int) (1000-(stats->counters.requested*1000)/stats->counters.allocated) : 0;
+#else
+    stats->internal = 0;
+#endif
+}
 
+#ifndef BUDDY_NODEFAULTHEAP
+/**
+ *  @brief  Default heap
+ */
+///@{
+static buddy_heap defaultheap;
+static BUDDY_METADATA_DECLARE(defaultmetadata,BUDDYTOTALSIZE,BUDDYMINSIZE);
+///@}
 
 /**
  *  @brief  buddy_init
@@ -88,8 +2552,8 @@ typedef struct {
 void
 buddy_init(void) {
 
-    bv_clearall(used,MAPSIZE*2);
-    bv_clearall(split,MAPSIZE*2);
+    buddy_heap_init(&defaultheap,(void *) BUDDYBASE,BUDDYTOTALSIZE,BUDDYMINSIZE,
+                    defaultmetadata);
 }
 
 /**
@@ -97,115 +2561,120 @@ buddy_init(void) {
  */
 void *
 buddy_alloc(unsigned size) {
-int level;
-int s;
-int k;
-int l;
-uint32_t a;
 
-nodeinfo stack[MAPSIZE];
-int sp;
-nodeinfo node;
+    return buddy_heap_alloc(&defaultheap,size);
+}
 
-    // Too big?
-    if( size > BUDDYTOTALSIZE )
-        return 0;
+/**
+ *  @brief  buddy_alloc_aligned
+ */
+void *
+buddy_alloc_aligned(unsigned size, unsigned align) {
 
-    // Already full
-    if( bv_test(used,0) )
-        return 0;
+    return buddy_heap_alloc_aligned(&defaultheap,size,align);
+}
 
-    sp = 0;
-    stack[sp].level = 0;
-    stack[sp].index = 0;
-    stack[sp].size = BUDDYTOTALSIZE;
-    stack[sp].addr = 0;
-    sp++;
+/**
+ *  @brief  buddy_realloc
+ */
+void *
+buddy_realloc(void *addr, unsigned size) {
 
-    while( sp > 0 ) {
-        sp--;
-        node = stack[sp];
-        k = node.index;
-        s = node.size;
-        a = node.addr;
-        l = node.level;
-
-        // test if block already used
-        if( bv_test(used,k) )
-            continue;
-        // test if need full block
-        if( (size > s/2) || (s == BUDDYMINSIZE) ) {
-            // if already split, try another block
-            if( bv_test(split,k) == 0 ) {
-                // reserve it
-                bv_set(used,k);
-                return (void *) ((char *) BUDDYBASE+a);
-            }
-        }
-        s /= 2;
-        if( size > s )
-            continue;
+    return buddy_heap_realloc(&defaultheap,addr,size);
+}
 
-        // Mark as split
-        bv_set(split,k);
-        // Try left and right leaves.
-        l++;
-        //Left must be on top of stack
-        stack[sp].index = 2*k+2;
-        stack[sp].addr  = a+s;
-        stack[sp].size  = s;
-        stack[sp].level = l;
-        sp++;
-        stack[sp].index = 2*k+1;
-        stack[sp].addr  = a;
-        stack[sp].size  = s;
-        stack[sp].level = l;
-        sp++;
-    }
-    return 0;
+/**
+ *  @brief  buddy_free
+ */
+void
+buddy_free(void *addr) {
+
+    buddy_heap_free(&defaultheap,addr);
 }
 
-static inline int isodd(int n) { return n&1; }
-static inline int iseven(int n) { return (n&1)^1; }
+/**
+ *  @brief  buddy_free_sized
+ */
+void
+buddy_free_sized(void *addr, unsigned size) {
+
+    buddy_heap_free_sized(&defaultheap,addr,size);
+}
 
 /**
- *  @brief  buddy_free
+ *  @brief  buddy_alloc_bulk
  */
-void buddy_free(void *addr) {
-uint32_t disp = (char *) addr - (char *)BUDDYBASE;       // 4 GB limit
-int b,d,k,p;
+int
+buddy_alloc_bulk(unsigned size, int count, void **out) {
 
-    d = disp/BUDDYMINSIZE;
+    return buddy_heap_alloc_bulk(&defaultheap,size,count,out);
+}
 
-    k = MAPSIZE+d-1;
-    // Free if it is not
-    bv_clear(used,k);
-    bv_clear(split,k);
-    // Find block to be freed
-    while( k > 0 ) {
-            k /= 2;
-        if( bv_test(used,k) ) {
-            bv_clear(used,k);
-            bv_clear(split,k);
-            break;
-        }
-    }
-    // Adjust parents
-    while( k > 0 ) {
-        // find buddy
+/**
+ *  @brief  buddy_free_bulk
+ */
+void
+buddy_free_bulk(void **ptrs, int count) {
 
-        if( isodd(k) )
-            b = k+1;
-        else
-            b = k-1;
-        if( (bv_test(used,k)==0)&&(bv_test(used,b)==0)&&(bv_test(split,k)==0)&&(bv_test(split,b))) {
-            p = k/2;
-            bv_clear(split,p);
-        }
-        k /= 2;
-    }
+    buddy_heap_free_bulk(&defaultheap,ptrs,count);
+}
+
+/**
+ *  @brief  buddy_free_subtree
+ */
+int
+buddy_free_subtree(void *addr, unsigned size) {
+
+    return buddy_heap_free_subtree(&defaultheap,addr,size);
+}
+
+/**
+ *  @brief  buddy_reset
+ */
+unsigned
+buddy_reset(void) {
+
+    return buddy_heap_reset(&defaultheap);
+}
+
+/**
+ *  @brief  buddy_setpolicy
+ */
+int
+buddy_setpolicy(int policy) {
+
+    return buddy_heap_setpolicy(&defaultheap,policy);
+}
+
+/**
+ *  @brief  buddy_stats
+ */
+void
+buddy_stats(buddy_statistics *stats) {
+
+    buddy_heap_stats(&defaultheap,stats);
+}
+
+#ifdef BUDDY_ATOMIC
+/**
+ *  @brief  buddy_alloc_lockfree
+ */
+void *
+buddy_alloc_lockfree(void) {
+
+    return buddy_heap_alloc_lockfree(&defaultheap);
 }
 
+/**
+ *  @brief  buddy_free_lockfree
+ */
+int
+buddy_free_lockfree(void *addr) {
+
+    return buddy_heap_free_lockfree(&defaultheap,addr);
+}
+#endif
+#endif
 
 
 #ifdef DEBUG
@@ -229,89 +2698,67 @@ int i;
 
 /**
  *  @brief  buildmap
+ *
+ *  @note   only the used nodes are visited, skipping a whole element of
+ *          the bit vector when it is zero (all nodes are tested in the
+ *          blocked layout)
  */
 static void
-buildmap(char *m) {
-int level;
+buildmap(buddy_heap *heap, char *m) {
 int s;
 int k;
 int l;
-uint32_t a;
-nodeinfo stack[MAPSIZE];
-int sp;
-nodeinfo node;
-
-    fillmap(m,0,MAPSIZE,'-');
-
-    sp = 0;
-    stack[sp].level = 0;
-    stack[sp].index = 0;
-    stack[sp].size = BUDDYTOTALSIZE/BUDDYMINSIZE;
-    stack[sp].addr = 0;
-    sp++;
+int a;
+int treesize = 2*heap->mapsize-1;
 
-    while(sp>0) {
-        sp--;
-        node = stack[sp];
-        k = node.index;
-        s = node.size;
-        a = node.addr;
-        l = node.level;
-        // test if block already used
-        if( bv_test(used,k) ) {
-            fillmap(m,a,a+s,'U');
-        }
+    fillmap(m,0,heap->mapsize,'-');
 
-        if( s == 1 )
+#ifdef BUDDY_BLOCKED
+    for(k=0;k<treesize;k++) {
+        if( !isused(heap,k) )
             continue;
-
-        s /= 2;
-        // Try left and right leaves.
-        l++;
-        //Left must be on top of stack
-        stack[sp].index = 2*k+2;
-        stack[sp].addr  = a+s;
-        stack[sp].size  = s;
-        stack[sp].level = l;
-        sp++;
-        stack[sp].index = 2*k+1;
-        stack[sp].addr  = a;
-        stack[sp].size  = s;
-        stack[sp].level = l;
-        sp++;
-
+#else
+    k = bv_findnextset(heap->used,0,treesize);
+    for(;k>=0;k=bv_findnextset(heap->used,k+1,treesize)) {
+#endif
+        l = bv_log2(k+1);
+        s = heap->mapsize>>l;
+        a = (k-levelfirst(l))*s;
+        fillmap(m,a,a+s,'U');
     }
 
-    m[MAPSIZE] = '\0';
+    m[heap->mapsize] = '\0';
 }
 
 
 /**
  *  @brief  print allocation map
  */
-void buddy_printmap(void) {
-char map[MAPSIZE+1];
-    buildmap(map);
+void buddy_heap_printmap(buddy_heap *heap) {
+char map[heap->mapsize+1];
+    buildmap(heap,map);
     printf("|%s|\n",map);
 }
 
 
 
-void buddy_printaddresses(void) {
+void buddy_heap_printaddresses(buddy_heap *heap) {
 int level;
 int k;
 int lim;
-uint32_t addr;
-uint32_t size;
+size_t addr;
+size_t size;
 int delta;
+int treesize = 2*heap->mapsize-1;
 
     level = 0;
-    size = BUDDYTOTALSIZE;
+    size = levelsize(heap,0);
     lim = 0;
     addr = 0;
     delta = 1;
-    for(k=0;k<TREESIZE;k++) {
-        printf("level = %-2d node = %-3d address = %08X  size=%08X\n",level,k,addr,size);
+    for(k=0;k<treesize;k++) {
+        printf("level = %-2d node = %-3d address = %08lX  size=%08lX\n",
+               level,k,(unsigned long) addr,(unsigned long) size);
         if( k == lim ) {
             level++;
             delta *= 2;
@@ -325,5 +2772,14 @@ int delta;
     }
 }
 
+#ifndef BUDDY_NODEFAULTHEAP
+void buddy_printmap(void) {
+    buddy_heap_printmap(&defaultheap);
+}
+
+void buddy_printaddresses(void) {
+    buddy_heap_printaddresses(&defaultheap);
+}
 #endif
 
+#endif
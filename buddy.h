@@ -7,12 +7,20 @@
  *  @date   27/10/2020
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
- *  @brief  Size definition
+ *  @brief  Size definition of the default heap
 */
 ///@{
-/// Total size of area to be managed. Must be a power of 2
+/// Total size of area to be managed. A multiple of BUDDYMINSIZE
 #ifndef BUDDYTOTALSIZE
 #define BUDDYTOTALSIZE   16384
 #endif
@@ -26,13 +34,372 @@
 #endif
 ///@}
 
+/// Upper limit for the tree depth
+#define BUDDY_MAXLEVELS  32
+/// Upper limit for the number of blocks of the minimal size (the 2N nodes are counted in an int)
+#define BUDDY_MAXLEAVES  (((size_t) 1)<<(BUDDY_MAXLEVELS-3))
+/// Upper limit for the number of summary vectors of avail
+#define BUDDY_SUMMARYLEVELS 6
+
+/**
+ *  @brief  Number of leaves of the tree of a heap with N blocks of the minimal size
+ *
+ *  @note   N rounded up to a power of 2
+ */
+///@{
+#define BUDDY_SMEAR1(X)     ((X)|((X)>>1))
+#define BUDDY_SMEAR2(X)     (BUDDY_SMEAR1(X)|(BUDDY_SMEAR1(X)>>2))
+#define BUDDY_SMEAR4(X)     (BUDDY_SMEAR2(X)|(BUDDY_SMEAR2(X)>>4))
+#define BUDDY_SMEAR8(X)     (BUDDY_SMEAR4(X)|(BUDDY_SMEAR4(X)>>8))
+#define BUDDY_SMEAR16(X)    (BUDDY_SMEAR8(X)|(BUDDY_SMEAR8(X)>>16))
+#define BUDDY_LEAVES(N)     (BUDDY_SMEAR16((N)-1)+1)
+///@}
+
+/**
+ *  @brief  Blocked layout of the tree
+ *
+ *  @note   When BUDDY_BLOCKED is defined, the used and split bits of a node are
+ *          adjacent in one bit vector, and the tree is stored as subtrees of
+ *          BUDDY_BLOCKHEIGHT levels, each one in a block of 2^BUDDY_BLOCKHEIGHT
+ *          pairs of bits. With the default, a block is a cache line of 64 bytes
+ *          and a path from the root to a leaf touches one line per 8 levels.
+ */
+///@{
+#ifdef BUDDY_BLOCKED
+#ifndef BUDDY_BLOCKHEIGHT
+#define BUDDY_BLOCKHEIGHT   8
+#endif
+/// Bytes in a block
+#define BUDDY_BLOCKBYTES    ((1<<BUDDY_BLOCKHEIGHT)/4)
+/// Upper limit for the number of pairs of bits of a tree with N leaves
+#define BUDDY_NODESLOTS(N)  (((2*(N))/((1<<BUDDY_BLOCKHEIGHT)-1)+1)<<BUDDY_BLOCKHEIGHT)
+#endif
+///@}
+
+/**
+ *  @brief  Lazy coalescing
+ *
+ *  @note   When BUDDY_LAZY is defined, the blocks of the BUDDY_LAZY_LEVELS lowest
+ *          levels are not merged when freed. They are kept in a list per level,
+ *          with up to BUDDY_LAZY_WATERMARK blocks, and given back by the next
+ *          allocations of the same size.
+ */
+///@{
+#ifdef BUDDY_LAZY
+#ifndef BUDDY_LAZY_LEVELS
+#define BUDDY_LAZY_LEVELS       8
+#endif
+#ifndef BUDDY_LAZY_WATERMARK
+#define BUDDY_LAZY_WATERMARK    32
+#endif
+#endif
+///@}
+
+/**
+ *  @brief  Placement policies
+ *
+ *  @note   They choose the free block split or taken by an allocation. All of
+ *          them look only at the bitmaps of free blocks of the levels.
+ */
+///@{
+/// Smallest free block that fits, at the lowest address (default)
+#define BUDDY_POLICY_FIRSTFIT   0
+/// As FIRSTFIT, but preferring a block whose buddy is allocated, so that the
+/// blocks whose buddies are partly free can still be merged
+#define BUDDY_POLICY_BESTFIT    1
+/// Free block that fits at the lowest address, even if larger, to keep the
+/// blocks in use dense at the start of the area
+#define BUDDY_POLICY_ADDRESS    2
+/// Smallest free block that fits, at the highest address, e.g. for long lived
+/// blocks in a heap whose other blocks are taken from the start
+#define BUDDY_POLICY_TOPDOWN    3
+/// Number of blocks of a level examined by BUDDY_POLICY_BESTFIT
+#ifndef BUDDY_BESTFIT_PROBES
+#define BUDDY_BESTFIT_PROBES    8
+#endif
+///@}
+
+/**
+ *  @brief  Purge of free blocks
+ *
+ *  @note   A heap with a purge routine (buddy_heap_setpurge) calls it with each
+ *          free block of at least the purge size formed by a free, before the
+ *          block is made available, e.g. to give its pages back to the system.
+ */
+typedef void (*buddy_purgefn)(void *addr, size_t size, void *arg);
+
+/**
+ *  @brief  Checked mode
+ *
+ *  @note   When BUDDY_CHECKED is defined, a free of an address that is not the
+ *          start of a block in use (e.g. a block freed twice), or with the size
+ *          of another block, is reported to the error routine of the heap
+ *          (buddy_heap_seterror). A block with room after the request gets a
+ *          canary after it and a tag with the size of the request at its end,
+ *          checked when it is freed. The first BUDDY_POISONSIZE bytes of a freed
+ *          block are filled with BUDDY_POISONBYTE.
+ */
+///@{
+#ifdef BUDDY_CHECKED
+#ifndef BUDDY_POISONSIZE
+#define BUDDY_POISONSIZE        64
+#endif
+#ifndef BUDDY_POISONBYTE
+#define BUDDY_POISONBYTE        0xDD
+#endif
+/// Value of the canary (8 bytes) and key of the tag
+#define BUDDY_CANARY            0xC0DEFACE5AFEB10CULL
+#endif
+#define BUDDY_ERROR_INVALID     1           ///< not the start of a block in use
+#define BUDDY_ERROR_SIZE        2           ///< free with the size of another block
+#define BUDDY_ERROR_CANARY      3           ///< bytes after the request overwritten
+typedef void (*buddy_errorfn)(void *addr, int error, void *arg);
+///@}
+
+/**
+ *  @brief  Counters kept when BUDDY_STATS is defined
+ *
+ *  @note   The arrays are indexed by order (0 is the smallest block)
+ */
+typedef struct {
+    unsigned long       allocs[BUDDY_MAXLEVELS];    ///< allocations per order
+    unsigned long       frees[BUDDY_MAXLEVELS];     ///< frees per order
+    unsigned long       failures;                   ///< allocations not attended
+    size_t              inuse;                      ///< bytes in allocated blocks
+    size_t              peak;                       ///< maximum of inuse
+    unsigned long long  requested;                  ///< bytes requested (cumulative)
+    unsigned long long  allocated;                  ///< bytes in blocks given (cumulative)
+} buddy_counters;
+
+/**
+ *  @brief  Snapshot returned by buddy_heap_stats
+ */
+typedef struct {
+    size_t          size;                           ///< size of heap
+    size_t          free;                           ///< bytes in free blocks
+    size_t          largest;                        ///< largest free block
+    int             fragmentation;                  ///< 1000*(1-largest/free)
+    int             internal;                       ///< 1000*(1-requested/allocated)
+#ifdef BUDDY_STATS
+    buddy_counters  counters;
+#endif
+} buddy_statistics;
+
+/**
+ *  @brief  Metadata of a heap
+ *
+ *  @note   The bit vectors used, split and avail point into a buffer given by
+ *          the caller. Its size is given by BUDDY_METADATASIZE. With
+ *          BUDDY_BLOCKED, used and split are replaced by nodes. With
+ *          BUDDY_ORDERMAP, the order of each block in use is also kept at its
+ *          first leaf, so its node is found without a search by the frees and
+ *          buddy_heap_usable_size.
+ */
+typedef struct {
+    char       *base;                       ///< address of area to be managed
+    size_t      size;                       ///< size of area (multiple of minsize)
+    size_t      minsize;                    ///< minimal size of a block (power of 2)
+    int         minshift;                   ///< log2 of minsize
+    int         leaflevel;                  ///< level of the smallest blocks
+    int         mapsize;                    ///< number of leaves of the tree (power of 2)
+#ifdef BUDDY_BLOCKED
+    bv_type     nodes;                      ///< used and split bits, by blocks
+    int         bandbase[BUDDY_MAXLEVELS];  ///< first pair of the blocks of a level
+    int         bandlevel[BUDDY_MAXLEVELS]; ///< level inside the subtree of a block
+#else
+    bv_type     used;                       ///< used/free map
+    bv_type     split;                      ///< already split
+#endif
+    bv_type     avail;                      ///< free blocks per level
+    bv_type     summary[BUDDY_SUMMARYLEVELS]; ///< elements of the vector below with set bits
+    int         nsummary;                   ///< number of summary vectors
+    int         nfree[BUDDY_MAXLEVELS];     ///< number of free blocks per level
+    unsigned    generation;                 ///< changes with each init and reset
+    int         policy;                     ///< placement policy
+    int         purgelevel;                 ///< level of the purge size or -1
+    buddy_purgefn purge;                    ///< purge routine or 0
+    void       *purgearg;                   ///< argument of purge
+#ifdef BUDDY_ORDERMAP
+    uint8_t    *ordermap;                   ///< order of the block at each leaf, 4 bits
+#endif
+#ifdef BUDDY_CHECKED
+    bv_type     guard;                      ///< leaves where a block with a trailer starts
+    buddy_errorfn error;                    ///< error routine or 0
+    void       *errorarg;                   ///< argument of error
+    unsigned long errors;                   ///< errors found
+#endif
+#ifdef BUDDY_ATOMIC
+    int         pending;                    ///< leaves freed without lock to be merged
+#endif
+#ifdef BUDDY_LAZY
+    int         nlazy[BUDDY_LAZY_LEVELS];   ///< number of blocks not merged per order
+    int         lazy[BUDDY_LAZY_LEVELS][BUDDY_LAZY_WATERMARK]; ///< blocks not merged
+#endif
+#ifdef BUDDY_STATS
+    buddy_counters counters;                ///< statistics
+#endif
+#ifdef BUDDY_TRACE
+    struct buddy_trace *trace;              ///< trace of the operations or 0
+#endif
+} buddy_heap;
+
+/**
+ *  @brief  Size of the metadata buffer of a heap
+ */
+///@{
+/// Elements of the vector of guarded leaves of BUDDY_CHECKED
+#ifdef BUDDY_CHECKED
+#define BUDDY_GUARDWORDS(SIZE,MINSIZE)      BV_SIZE(BUDDY_LEAVES((SIZE)/(MINSIZE)))
+#else
+#define BUDDY_GUARDWORDS(SIZE,MINSIZE)      0
+#endif
+/// Elements of the order map of BUDDY_ORDERMAP (4 bits per leaf)
+#ifdef BUDDY_ORDERMAP
+#define BUDDY_ORDERWORDS(SIZE,MINSIZE)      BV_SIZE(4*BUDDY_LEAVES((SIZE)/(MINSIZE)))
+#else
+#define BUDDY_ORDERWORDS(SIZE,MINSIZE)      0
+#endif
+/// Elements of the summary of avail (bounded, with the rounding of each vector)
+#define BUDDY_SUMMARYWORDS(SIZE,MINSIZE)    (BV_SIZE(2*BUDDY_LEAVES((SIZE)/(MINSIZE)))/(BV_BITS-1) \
+                                            +2*BUDDY_SUMMARYLEVELS+1)
+/// Number of BV_TYPE elements
+#ifdef BUDDY_BLOCKED
+#define BUDDY_METADATAWORDS(SIZE,MINSIZE)   (BV_SIZE(2*BUDDY_NODESLOTS(BUDDY_LEAVES((SIZE)/(MINSIZE)))) \
+                                            +BV_SIZE(2*BUDDY_LEAVES((SIZE)/(MINSIZE))) \
+                                            +BUDDY_SUMMARYWORDS(SIZE,MINSIZE) \
+                                            +BUDDY_GUARDWORDS(SIZE,MINSIZE) \
+                                            +BUDDY_ORDERWORDS(SIZE,MINSIZE))
+#else
+#define BUDDY_METADATAWORDS(SIZE,MINSIZE)   (3*BV_SIZE(2*BUDDY_LEAVES((SIZE)/(MINSIZE))) \
+                                            +BUDDY_SUMMARYWORDS(SIZE,MINSIZE) \
+                                            +BUDDY_GUARDWORDS(SIZE,MINSIZE) \
+                                            +BUDDY_ORDERWORDS(SIZE,MINSIZE))
+#endif
+/// Number of bytes
+#define BUDDY_METADATASIZE(SIZE,MINSIZE)    (BUDDY_METADATAWORDS(SIZE,MINSIZE)*sizeof(BV_TYPE))
+/// Declare a metadata buffer
+#if defined(BUDDY_BLOCKED) && defined(__GNUC__)
+#define BUDDY_METADATA_DECLARE(X,SIZE,MINSIZE) \
+        BV_TYPE X[BUDDY_METADATAWORDS(SIZE,MINSIZE)] __attribute__((aligned(BUDDY_BLOCKBYTES)))
+#else
+#define BUDDY_METADATA_DECLARE(X,SIZE,MINSIZE) \
+        BV_TYPE X[BUDDY_METADATAWORDS(SIZE,MINSIZE)]
+#endif
+///@}
+
+/**
+ *  @brief  Persistent heap
+ *
+ *  @note   An image has this header, with the heap, followed by the metadata,
+ *          in a region given by the caller (e.g. a mapped file or shared
+ *          memory). The vectors are given by their offsets from the header,
+ *          so the image can be mapped at another address by a later process.
+ *          The compile options (config) of the processes must be the same.
+ */
+///@{
+typedef struct {
+    char        magic[4];                   ///< "BUDH"
+    uint32_t    version;                    ///< BUDDY_IMAGE_VERSION
+    uint32_t    config;                     ///< compile options and size of buddy_heap
+    uint32_t    state;                      ///< BUDDY_IMAGE_CLEAN or BUDDY_IMAGE_ATTACHED
+    uint64_t    vectors[3];                 ///< offsets of the bit vectors
+    buddy_heap  heap;                       ///< heap, with pointers valid while attached
+} buddy_image;
+
+#define BUDDY_IMAGE_VERSION     2
+#define BUDDY_IMAGE_CLEAN       0           ///< detached
+#define BUDDY_IMAGE_ATTACHED    1           ///< in use (or not detached before a crash)
+/// Bytes before the metadata (a multiple of a cache line)
+#define BUDDY_IMAGEHEADER       ((sizeof(buddy_image)+63)&~(size_t) 63)
+/// Size of the image of a heap
+#define BUDDY_IMAGESIZE(SIZE,MINSIZE)   (BUDDY_IMAGEHEADER+BUDDY_METADATASIZE(SIZE,MINSIZE))
+///@}
+
+int   buddy_heap_init(buddy_heap *heap, void *base, size_t size, size_t minsize,
+                      void *metadata);
+void *buddy_heap_alloc(buddy_heap *heap, size_t size);
+void *buddy_heap_alloc_aligned(buddy_heap *heap, size_t size, size_t align);
+void  buddy_heap_free(buddy_heap *heap, void *addr);
+void  buddy_heap_free_sized(buddy_heap *heap, void *addr, size_t size);
+void *buddy_heap_alloc_level(buddy_heap *heap, int level, size_t size);
+void  buddy_heap_free_level(buddy_heap *heap, void *addr, int level);
+size_t buddy_heap_usable_size(buddy_heap *heap, void *addr);
+void *buddy_heap_realloc(buddy_heap *heap, void *addr, size_t size);
+int   buddy_heap_alloc_bulk(buddy_heap *heap, size_t size, int count, void **out);
+void  buddy_heap_free_bulk(buddy_heap *heap, void **ptrs, int count);
+int   buddy_heap_free_subtree(buddy_heap *heap, void *addr, size_t size);
+unsigned buddy_heap_reset(buddy_heap *heap);
+buddy_heap *buddy_heap_format(void *image, void *base, size_t size, size_t minsize);
+buddy_heap *buddy_heap_attach(void *image, void *base, int repair);
+buddy_heap *buddy_heap_rebase(void *image, void *base);
+void  buddy_heap_detach(buddy_heap *heap);
+int   buddy_heap_check(buddy_heap *heap, int repair);
+int   buddy_heap_setpolicy(buddy_heap *heap, int policy);
+int   buddy_heap_setpurge(buddy_heap *heap, size_t size, buddy_purgefn purge, void *arg);
+void  buddy_heap_stats(buddy_heap *heap, buddy_statistics *stats);
+#ifdef BUDDY_LAZY
+void  buddy_heap_merge(buddy_heap *heap);
+#endif
+#ifdef BUDDY_CHECKED
+void  buddy_heap_seterror(buddy_heap *heap, buddy_errorfn error, void *arg);
+#endif
+#ifdef BUDDY_TRACE
+struct buddy_trace;
+void  buddy_heap_settrace(buddy_heap *heap, struct buddy_trace *trace);
+#endif
+
+/**
+ *  @brief  Lock free allocation of blocks of the minimal size
+ *
+ *  @note   Compiled when BUDDY_ATOMIC is defined. Then all updates of the bit
+ *          vectors are atomic, and these routines can run concurrently with
+ *          each other and with the other routines (that must still be
+ *          serialized among themselves, e.g. by a mutex). They can be called
+ *          from interrupt handlers.
+ */
+///@{
+#ifdef BUDDY_ATOMIC
+void *buddy_heap_alloc_lockfree(buddy_heap *heap);
+int   buddy_heap_free_lockfree(buddy_heap *heap, void *addr);
+#endif
+///@}
+
+/**
+ *  @brief  Routines using the default heap
+ *
+ *  @note   The default heap manages BUDDYTOTALSIZE bytes at BUDDYBASE. Define
+ *          BUDDY_NODEFAULTHEAP to drop it (and its metadata).
+ */
+///@{
+#ifndef BUDDY_NODEFAULTHEAP
 void  buddy_init(void);
 void *buddy_alloc(unsigned size);
+void *buddy_alloc_aligned(unsigned size, unsigned align);
 void  buddy_free(void *addr);
+void  buddy_free_sized(void *addr, unsigned size);
+void *buddy_realloc(void *addr, unsigned size);
+int   buddy_alloc_bulk(unsigned size, int count, void **out);
+void  buddy_free_bulk(void **ptrs, int count);
+int   buddy_free_subtree(void *addr, unsigned size);
+unsigned buddy_reset(void);
+int   buddy_setpolicy(int policy);
+void  buddy_stats(buddy_statistics *stats);
+#ifdef BUDDY_ATOMIC
+void *buddy_alloc_lockfree(void);
+int   buddy_free_lockfree(void *addr);
+#endif
+#endif
+///@}
 
 #ifdef DEBUG
+void buddy_heap_printmap(buddy_heap *heap);
+void buddy_heap_printaddresses(buddy_heap *heap);
+#ifndef BUDDY_NODEFAULTHEAP
 void buddy_printmap(void);
 void buddy_printaddresses(void);
 #endif
 #endif
-
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,154 @@
+#ifndef BUDDY_HPP
+#define BUDDY_HPP
+/**
+ *  @file   buddy.hpp
+ *
+ *  @note   C++ interface to a heap whose geometry is fixed at compile time
+ *
+ *  @note
+ *    BuddyAllocator<Base,TotalSize,MinSize> is a heap with its metadata inside the
+ *    object. The sizes are checked, and the geometry of the tree (number of leaves,
+ *    levels, shifts, the first node of a level and the level of a request) is
+ *    computed at compile time. When Base is 0, the area is also inside the object.
+ *
+ *    The operations pass the level of a request to buddy_heap_alloc_level and
+ *    buddy_heap_free_level, so buddy.c does not compute it. allocate<N>() and
+ *    deallocate<N>() resolve it at compile time; for a size known only at run
+ *    time it is a few inlined shifts with constant operands. The tree itself is
+ *    kept by the routines of buddy.c. The constructor checks that the heap has
+ *    the geometry computed here, and throws std::invalid_argument otherwise.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "buddy.h"
+
+namespace buddy {
+
+/**
+ *  @brief  Compile time arithmetic
+ */
+///@{
+/// Non zero if n is a power of 2
+constexpr bool ispowerof2(size_t n) { return (n != 0) && ((n&(n-1)) == 0); }
+/// log2 of n rounded down
+constexpr int log2(size_t n) { return n <= 1 ? 0 : 1+log2(n>>1); }
+/// n rounded up to a power of 2
+constexpr size_t roundup(size_t n, size_t p = 1) { return p >= n ? p : roundup(n,p<<1); }
+///@}
+
+/**
+ *  @brief  Area of a heap
+ *
+ *  @note   At address Base or, when it is 0, inside the object, aligned to Align.
+ *          Then any alignment can be obtained by allocate(n,align). Objects with
+ *          an alignment over the one of std::max_align_t must not be created
+ *          with new before C++17.
+ */
+///@{
+template<uintptr_t Base, size_t Size, size_t Align>
+class BuddyArea {
+protected:
+    void *area() { return reinterpret_cast<void *>(Base); }
+};
+
+template<size_t Size, size_t Align>
+class BuddyArea<0,Size,Align> {
+protected:
+    void *area() { return storage; }
+private:
+    alignas(Align) unsigned char storage[Size];
+};
+///@}
+
+/**
+ *  @brief  BuddyAllocator
+ */
+template<uintptr_t Base, size_t TotalSize, size_t MinSize>
+class BuddyAllocator : private BuddyArea<Base,TotalSize,(MinSize < 4096 ? MinSize : 4096)> {
+
+    static_assert(ispowerof2(MinSize),"MinSize must be a power of 2");
+    static_assert(TotalSize >= MinSize,"TotalSize must not be smaller than MinSize");
+    static_assert(TotalSize/MinSize <= BUDDY_MAXLEAVES,"Tree too deep");
+
+public:
+    /// Size of the area (rounded down to a multiple of MinSize)
+    static constexpr size_t size = TotalSize-TotalSize%MinSize;
+    /// Minimal size of a block
+    static constexpr size_t minsize = MinSize;
+    /// log2 of MinSize
+    static constexpr int minshift = log2(MinSize);
+    /// Number of leaves of the tree
+    static constexpr size_t leaves = roundup(TotalSize/MinSize);
+    /// Level of the leaves (the root is at level 0)
+    static constexpr int leaflevel = log2(leaves);
+    /// Number of levels and of nodes of the tree
+    static constexpr int levels = leaflevel+1;
+    static constexpr size_t nodes = 2*leaves-1;
+    /// Size of the metadata in bytes
+    static constexpr size_t metadatasize = BUDDY_METADATASIZE(TotalSize,MinSize);
+
+    static_assert(levels <= BUDDY_MAXLEVELS,"Tree too deep");
+    static_assert(metadatasize*8 >= 2*nodes,"Metadata smaller than the tree");
+
+    /// First node of level l. The nodes of l are [levelfirst(l),levelfirst(l+1)[
+    static constexpr size_t levelfirst(int l) { return (((size_t) 1)<<l)-1; }
+    /// Level of the blocks that attend a request of n bytes (-1 if none)
+    static constexpr int levelof(size_t n) {
+        return n > size ? -1 :
+               n <= MinSize ? leaflevel : leaflevel-log2((n-1)>>minshift)-1;
+    }
+    /// Size of the blocks of level l
+    static constexpr size_t levelsize(int l) { return MinSize<<(leaflevel-l); }
+    /// Size of the block that attends a request of n bytes
+    static constexpr size_t blocksize(size_t n) { return levelof(n) < 0 ? 0 : levelsize(levelof(n)); }
+
+    BuddyAllocator() {
+        if( (buddy_heap_init(&heap_,this->area(),TotalSize,MinSize,metadata_) != 0) ||
+            (heap_.leaflevel != leaflevel) || (heap_.minshift != minshift) )
+            throw std::invalid_argument("BuddyAllocator: geometry of the heap");
+    }
+    BuddyAllocator(const BuddyAllocator &) = delete;
+    BuddyAllocator &operator=(const BuddyAllocator &) = delete;
+
+    void *allocate(size_t n) { return buddy_heap_alloc_level(&heap_,levelof(n),n); }
+    void *allocate(size_t n, size_t align) { return buddy_heap_alloc_aligned(&heap_,n,align); }
+    void *reallocate(void *p, size_t n) { return buddy_heap_realloc(&heap_,p,n); }
+    void  deallocate(void *p) { buddy_heap_free(&heap_,p); }
+    void  deallocate(void *p, size_t n) { buddy_heap_free_level(&heap_,p,levelof(n)); }
+    size_t usable_size(void *p) { return buddy_heap_usable_size(&heap_,p); }
+    void  stats(buddy_statistics *st) { buddy_heap_stats(&heap_,st); }
+
+    /// Allocation and free of a size known at compile time, with its level
+    template<size_t N>
+    void *allocate() {
+        static_assert(N <= size,"Request larger than the heap");
+        constexpr int l = levelof(N);
+        return buddy_heap_alloc_level(&heap_,l,N);
+    }
+    template<size_t N>
+    void deallocate(void *p) {
+        static_assert(N <= size,"Request larger than the heap");
+        constexpr int l = levelof(N);
+        buddy_heap_free_level(&heap_,p,l);
+    }
+
+    /// Non zero if p is in the area
+    bool owns(const void *p) const {
+        return (static_cast<const char *>(p) >= heap_.base) &&
+               (static_cast<const char *>(p) < heap_.base+size);
+    }
+
+    /// Heap, to use with the C routines
+    buddy_heap *heap() { return &heap_; }
+
+private:
+    buddy_heap  heap_;
+    BUDDY_METADATA_DECLARE(metadata_,TotalSize,MinSize);
+};
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ *  @file   buddyarena.c
+ *
+ *  @note   Arena of a thread, with objects allocated by bumping a pointer
+ *
+ *  @note
+ *    An arena takes blocks of blocksize bytes from a buddy heap. The objects are
+ *    carved from the current block by bumping a pointer, and the header at the
+ *    start of the block counts the objects not freed yet:
+ *
+ *       | next | prev | live | pad |  obj  |  obj  | ... | cur ->      | end
+ *
+ *    A free finds the block of an object from its address, as the blocks of the
+ *    heap are aligned to their size (relative to the base of the heap), and
+ *    decrements the count. When it gets to 0, the whole block goes back to the
+ *    heap with a single free, or the pointer is moved back to the start of the
+ *    block if it is the current one. When an object does not fit in the current
+ *    block, it is left in the list of full blocks until its objects are freed
+ *    and a new block is taken. buddy_arena_reset returns all the blocks at once,
+ *    for objects of a scope (e.g. a request) that are not freed one by one.
+ *
+ *    A request too large for the arena gets a block of the heap of its own, and
+ *    buddy_arena_free takes it back by its address alone: an address aligned to
+ *    blocksize is such a block, since the header takes the start of every block
+ *    of the arena (the same test as buddyslab.c).
+ *
+ *    The arena itself is not synchronized: it is used by one thread, and its
+ *    objects are freed by that thread. Only the heap is shared, under the lock.
+ */
+
+#include "buddyarena.h"
+
+/**
+ *  @brief  Calls to the heap, with the lock held
+ */
+///@{
+static void *
+heapalloc(buddy_arena *a, size_t size) {
+void *p;
+
+    if( a->lock )
+        pthread_mutex_lock(a->lock);
+    p = buddy_heap_alloc(a->heap,size);
+    if( a->lock )
+        pthread_mutex_unlock(a->lock);
+    return p;
+}
+
+static void
+heapfree(buddy_arena *a, void *addr, size_t size) {
+    if( a->lock )
+        pthread_mutex_lock(a->lock);
+    if( size )
+        buddy_heap_free_sized(a->heap,addr,size);
+    else
+        buddy_heap_free(a->heap,addr);
+    if( a->lock )
+        pthread_mutex_unlock(a->lock);
+}
+///@}
+
+/**
+ *  @brief  List of full blocks
+ */
+///@{
+static inline void
+pushblock(buddy_arena *a, buddy_arenablock *b) {
+    b->prev = 0;
+    b->next = a->full;
+    if( a->full )
+        a->full->prev = b;
+    a->full = b;
+}
+
+static inline void
+removeblock(buddy_arena *a, buddy_arenablock *b) {
+    if( b->prev )
+        b->prev->next = b->next;
+    else
+        a->full = b->next;
+    if( b->next )
+        b->next->prev = b->prev;
+}
+///@}
+
+/**
+ *  @brief  buddy_arena_init
+ *
+ *  @note   blocksize must be a power of 2, not smaller than the minimal size of
+ *          heap. Returns 0 if OK or -1 if it is not valid.
+ */
+int
+buddy_arena_init(buddy_arena *a, buddy_heap *heap, size_t blocksize, pthread_mutex_t *lock) {
+
+    if( (blocksize&(blocksize-1)) || (blocksize < heap->minsize) ||
+        (blocksize <= BUDDY_ARENA_HEADER) || (blocksize > heap->size) )
+        return -1;
+    a->heap = heap;
+    a->lock = lock;
+    a->blocksize = blocksize;
+    a->block = 0;
+    a->cur = 0;
+    a->end = 0;
+    a->full = 0;
+    a->blocks = 0;
+    return 0;
+}
+
+/**
+ *  @brief  buddy_arena_refill
+ *
+ *  @note   allocates an object of size bytes (already rounded) that does not fit
+ *          in the current block. Returns 0 if the heap has no free block.
+ */
+void *
+buddy_arena_refill(buddy_arena *a, size_t size) {
+buddy_arenablock *b;
+char *p;
+
+    if( size > a->blocksize-BUDDY_ARENA_HEADER )
+        return heapalloc(a,size);
+    if( a->block )
+        pushblock(a,a->block);
+    b = (buddy_arenablock *) heapalloc(a,a->blocksize);
+    a->block = b;
+    if( b == 0 ) {
+        a->cur = 0;
+        a->end = 0;
+        return 0;
+    }
+    a->blocks++;
+    b->live = 1;
+    p = (char *) b+BUDDY_ARENA_HEADER;
+    a->cur = p+size;
+    a->end = (char *) b+a->blocksize;
+    return p;
+}
+
+/**
+ *  @brief  buddy_arena_free
+ *
+ *  @note   frees an object allocated from a
+ */
+void
+buddy_arena_free(buddy_arena *a, void *addr) {
+buddy_arenablock *b;
+size_t disp;
+
+    if( addr == 0 )
+        return;
+    disp = (char *) addr-a->heap->base;
+    b = (buddy_arenablock *) (a->heap->base+(disp&~(a->blocksize-1)));
+    if( (char *) b == (char *) addr ) {
+        heapfree(a,addr,0);
+        return;
+    }
+    if( --b->live > 0 )
+        return;
+    if( b == a->block ) {
+        a->cur = (char *) b+BUDDY_ARENA_HEADER;
+        return;
+    }
+    removeblock(a,b);
+    heapfree(a,b,a->blocksize);
+}
+
+/**
+ *  @brief  buddy_arena_reset
+ *
+ *  @note   frees all the objects of the arena, returning its blocks to the heap.
+ *          The blocks given to requests larger than a block are not part of the
+ *          arena, and are not freed.
+ */
+void
+buddy_arena_reset(buddy_arena *a) {
+buddy_arenablock *b;
+
+    while( (b = a->full) != 0 ) {
+        a->full = b->next;
+        heapfree(a,b,a->blocksize);
+    }
+    if( a->block )
+        heapfree(a,a->block,a->blocksize);
+    a->block = 0;
+    a->cur = 0;
+    a->end = 0;
+}
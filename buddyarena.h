@@ -0,0 +1,85 @@
+#ifndef BUDDYARENA_H
+#define BUDDYARENA_H
+/**
+ *  @file   buddyarena.h
+ *
+ *  @note   Arena of a thread for short lived objects, allocated by bumping a
+ *          pointer in large blocks of a buddy heap
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Alignment of the objects (a power of 2)
+#ifndef BUDDY_ARENA_ALIGN
+#define BUDDY_ARENA_ALIGN       16
+#endif
+
+/**
+ *  @brief  Header of a block of an arena
+ *
+ *  @note   The objects follow it. Blocks with live objects other than the
+ *          current one are in a list, so a reset finds them.
+ */
+typedef struct buddy_arenablock {
+    struct buddy_arenablock *next;          ///< next full block
+    struct buddy_arenablock *prev;          ///< previous full block
+    long                     live;          ///< objects not freed
+} buddy_arenablock;
+
+/// Offset of the first object of a block
+#define BUDDY_ARENA_HEADER      ((sizeof(buddy_arenablock)+BUDDY_ARENA_ALIGN-1)&~(size_t) (BUDDY_ARENA_ALIGN-1))
+
+/**
+ *  @brief  Arena
+ *
+ *  @note   An arena is used by a single thread (e.g. declared __thread). Its
+ *          blocks come from heap, with lock held if it is not 0, so the arenas
+ *          of several threads can share a heap.
+ */
+typedef struct {
+    buddy_heap         *heap;               ///< heap of the blocks
+    pthread_mutex_t    *lock;               ///< protects heap or 0
+    size_t              blocksize;          ///< size of a block (power of 2)
+    buddy_arenablock   *block;              ///< current block or 0
+    char               *cur;                ///< next object of the current block
+    char               *end;                ///< end of the current block
+    buddy_arenablock   *full;               ///< other blocks with live objects
+    unsigned long       blocks;             ///< blocks taken from the heap
+} buddy_arena;
+
+int   buddy_arena_init(buddy_arena *a, buddy_heap *heap, size_t blocksize,
+                       pthread_mutex_t *lock);
+void *buddy_arena_refill(buddy_arena *a, size_t size);
+void  buddy_arena_free(buddy_arena *a, void *addr);
+void  buddy_arena_reset(buddy_arena *a);
+
+/**
+ *  @brief  buddy_arena_alloc
+ *
+ *  @note   returns an object of the current block, or calls buddy_arena_refill
+ *          when it does not fit. Requests larger than a block go to the heap.
+ */
+static inline void *
+buddy_arena_alloc(buddy_arena *a, size_t size) {
+char *p;
+
+    size = size ? (size+BUDDY_ARENA_ALIGN-1)&~(size_t) (BUDDY_ARENA_ALIGN-1) : BUDDY_ARENA_ALIGN;
+    if( (size_t) (a->end-a->cur) < size )
+        return buddy_arena_refill(a,size);
+    p = a->cur;
+    a->cur += size;
+    a->block->live++;
+    return p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
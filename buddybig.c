@@ -0,0 +1,417 @@
+/**
+ *  @file   buddybig.c
+ *
+ *  @note   Two level heap for large areas with small blocks
+ *
+ *  @note
+ *    The area is cut in chunks (e.g. of 2 MBytes), managed by a heap whose
+ *    smallest block is a chunk. Requests of a chunk or more are blocks of that
+ *    heap. A smaller request is attended by the heap of a chunk, a heap of its own
+ *    over the chunk, that exists only while the chunk has blocks in use:
+ *
+ *       top heap:   | chunk | chunk (heap) | chunk | chunk (records) | ... |
+ *
+ *    The metadata of a flat heap grows with the number of blocks of the minimal
+ *    size. Here the metadata given by the caller grows with the number of chunks,
+ *    and a chunk has metadata for its blocks only while it is split. The records
+ *    with these heaps are taken from chunks of the top heap (record pages), so no
+ *    memory has to be reserved for them. A record page counts its records in use
+ *    and goes back to the top heap when the last one is dropped.
+ *
+ *    An allocation looks for a chunk with a free block of its order in the bitmap
+ *    of that order (the first one, so the blocks are packed in the lowest chunks)
+ *    and allocates from its heap. If there is none, it takes a chunk from the top
+ *    heap. When the last block of a chunk is freed, its heap is dropped and the
+ *    chunk goes back to the top heap, where it can be merged again. All steps are
+ *    O(log N) or a search of a bitmap of chunks.
+ *
+ *    A big heap is locked by the caller as a whole, with one lock around all its
+ *    calls, buddy_big_usable_size and buddy_big_stats included. A lock per chunk
+ *    would not do: an allocation or free in one chunk can take or drop a chunk of
+ *    the top heap, a record page and the bits of the order bitmaps, all shared by
+ *    the chunks.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "buddybig.h"
+
+/**
+ *  @brief  order of a request (0 for the smallest block)
+ */
+static inline int
+order(buddy_bigheap *bh, size_t size) {
+    if( size <= bh->minsize )
+        return 0;
+    return bv_log2((size-1)>>bh->minshift)+1;
+}
+
+/**
+ *  @brief  chunkof
+ *
+ *  @note   returns the number of the chunk of addr or -1 if it is not in the area
+ */
+static inline int
+chunkof(buddy_bigheap *bh, void *addr) {
+size_t disp = (char *) addr-bh->top.base;
+
+    if( ((char *) addr < bh->top.base) || (disp >= bh->top.size) )
+        return -1;
+    return (int) (disp>>bh->chunkshift);
+}
+
+/**
+ *  @brief  update
+ *
+ *  @note   sets the bits of the chunk of c in the bitmaps after its largest free
+ *          block changed. With BUDDY_LAZY, the blocks not merged count as free
+ *          blocks of their order
+ */
+static void
+update(buddy_bigheap *bh, buddy_chunk *c) {
+int l,o,n;
+
+    n = -1;
+    for(l=0;l<=c->heap.leaflevel;l++) {
+        if( c->heap.nfree[l] > 0 ) {
+            n = c->heap.leaflevel-l;
+            break;
+        }
+    }
+#ifdef BUDDY_LAZY
+    for(o=n+1;(o<BUDDY_LAZY_LEVELS)&&(o<=bh->orders);o++)
+        if( c->heap.nlazy[o] > 0 )
+            n = o;
+#endif
+    for(o=c->largest+1;o<=n;o++)
+        bv_set(bh->hasfree[o],c->index);
+    for(o=n+1;o<=c->largest;o++)
+        bv_clear(bh->hasfree[o],c->index);
+    c->largest = n;
+}
+
+/// Offset of the first record of a record page
+#define RECORDS     BUDDY_BIG_ROUND(sizeof(buddy_recpage))
+
+/**
+ *  @brief  List of the record pages with free records
+ */
+///@{
+static inline void
+pushpage(buddy_bigheap *bh, buddy_recpage *r) {
+    r->prev = 0;
+    r->next = bh->recpages;
+    if( bh->recpages )
+        bh->recpages->prev = r;
+    bh->recpages = r;
+}
+
+static inline void
+removepage(buddy_bigheap *bh, buddy_recpage *r) {
+    if( r->prev )
+        r->prev->next = r->next;
+    else
+        bh->recpages = r->next;
+    if( r->next )
+        r->next->prev = r->prev;
+}
+///@}
+
+/**
+ *  @brief  pageof
+ *
+ *  @note   returns the record page of c. Pages are chunks of the top heap, so
+ *          they are aligned to a chunk from the base
+ */
+static inline buddy_recpage *
+pageof(buddy_bigheap *bh, buddy_chunk *c) {
+size_t disp = (char *) c-bh->top.base;
+
+    return (buddy_recpage *) (bh->top.base+(disp&~(bh->chunksize-1)));
+}
+
+/**
+ *  @brief  newrecord
+ *
+ *  @note   returns a free record, from a new record page if needed, or 0 if
+ *          there are no free chunks
+ */
+static buddy_chunk *
+newrecord(buddy_bigheap *bh) {
+buddy_recpage *r;
+buddy_chunk *c;
+
+    r = bh->recpages;
+    if( r == 0 ) {
+        r = (buddy_recpage *) buddy_heap_alloc(&bh->top,bh->chunksize);
+        if( r == 0 )
+            return 0;
+        r->freerecs = 0;
+        r->carved = 0;
+        r->inuse = 0;
+        pushpage(bh,r);
+    }
+    if( r->freerecs ) {
+        c = r->freerecs;
+        r->freerecs = c->next;
+    } else {
+        c = (buddy_chunk *) ((char *) r+RECORDS+r->carved*bh->recsize);
+        r->carved++;
+    }
+    if( ++r->inuse == bh->recsperpage )
+        removepage(bh,r);
+    return c;
+}
+
+/**
+ *  @brief  droprecord
+ *
+ *  @note   frees the record c, and its page when no other record is in use
+ */
+static void
+droprecord(buddy_bigheap *bh, buddy_chunk *c) {
+buddy_recpage *r;
+
+    r = pageof(bh,c);
+    if( r->inuse-- == bh->recsperpage )
+        pushpage(bh,r);
+    if( r->inuse == 0 ) {
+        removepage(bh,r);
+        buddy_heap_free_sized(&bh->top,r,bh->chunksize);
+        return;
+    }
+    c->next = r->freerecs;
+    r->freerecs = c;
+}
+
+/**
+ *  @brief  newchunk
+ *
+ *  @note   takes a chunk from the top heap and makes a heap on it. Returns its
+ *          record or 0 if there are no free chunks
+ */
+static buddy_chunk *
+newchunk(buddy_bigheap *bh) {
+buddy_chunk *c;
+char *p;
+
+    c = newrecord(bh);
+    if( c == 0 )
+        return 0;
+    p = (char *) buddy_heap_alloc(&bh->top,bh->chunksize);
+    if( p == 0 ) {
+        droprecord(bh,c);
+        return 0;
+    }
+    (void) buddy_heap_init(&c->heap,p,bh->chunksize,bh->minsize,
+                           (char *) c+BUDDY_BIG_ROUND(sizeof(buddy_chunk)));
+    c->heap.policy = bh->top.policy;
+    c->index = chunkof(bh,p);
+    c->largest = -1;
+    c->used = 0;
+    update(bh,c);
+    bh->chunks[c->index] = c;
+    bh->nsplit++;
+    return c;
+}
+
+/**
+ *  @brief  dropchunk
+ *
+ *  @note   returns a chunk whose blocks are all free to the top heap. The bits
+ *          are those of the last update
+ */
+static void
+dropchunk(buddy_bigheap *bh, buddy_chunk *c) {
+int o;
+
+    for(o=0;o<=c->largest;o++)
+        bv_clear(bh->hasfree[o],c->index);
+    bh->chunks[c->index] = 0;
+    bh->nsplit--;
+    buddy_heap_free_sized(&bh->top,c->heap.base,bh->chunksize);
+    droprecord(bh,c);
+}
+
+/**
+ *  @brief  freeinchunk
+ *
+ *  @note   frees the block at addr of the chunk of c (with its size if not 0),
+ *          and the chunk when it was its last block. An address that is not a
+ *          block in use is left to the heap of the chunk to report, and does
+ *          not count, or a double free would drop a chunk with live blocks.
+ */
+static void
+freeinchunk(buddy_bigheap *bh, buddy_chunk *c, void *addr, size_t size) {
+    if( buddy_heap_usable_size(&c->heap,addr) == 0 ) {
+        buddy_heap_free(&c->heap,addr);
+        return;
+    }
+    if( size )
+        buddy_heap_free_sized(&c->heap,addr,size);
+    else
+        buddy_heap_free(&c->heap,addr);
+    c->used--;
+    if( c->used == 0 )
+        dropchunk(bh,c);
+    else
+        update(bh,c);
+}
+
+/**
+ *  @brief  buddy_big_init
+ *
+ *  @note   initializes a two level heap over size bytes at base (rounded down to
+ *          a multiple of chunksize). metadata must point to a buffer with at
+ *          least BUDDY_BIG_METADATASIZE(size,chunksize) bytes, aligned to a cache
+ *          line. Returns 0 if OK or -1 if the sizes are not valid, including
+ *          a chunk too small for a record with the metadata of its heap.
+ */
+int
+buddy_big_init(buddy_bigheap *bh, void *base, size_t size, size_t chunksize,
+               size_t minsize, void *metadata) {
+char *m = (char *) metadata;
+size_t words;
+int o;
+
+    if( (chunksize == 0) || (chunksize&(chunksize-1)) || (minsize == 0) ||
+        (minsize&(minsize-1)) || (minsize >= chunksize) || (size < chunksize) )
+        return -1;
+    bh->chunksize = chunksize;
+    bh->minsize = minsize;
+    for(bh->chunkshift=0;(((size_t) 1)<<bh->chunkshift)<chunksize;bh->chunkshift++)
+        ;
+    for(bh->minshift=0;(((size_t) 1)<<bh->minshift)<minsize;bh->minshift++)
+        ;
+    bh->orders = bh->chunkshift-bh->minshift;
+    if( bh->orders >= BUDDY_BIG_MAXORDERS )
+        return -1;
+    bh->nchunks = (int) (size/chunksize);
+    bh->recsize = BUDDY_BIG_ROUND(sizeof(buddy_chunk))+
+                  BUDDY_BIG_ROUND(BUDDY_METADATASIZE(chunksize,minsize));
+    // The records are carved from chunks
+    if( RECORDS+bh->recsize > chunksize )
+        return -1;
+    bh->recsperpage = (int) ((chunksize-RECORDS)/bh->recsize);
+
+    bh->chunks = (buddy_chunk **) m;
+    memset(bh->chunks,0,bh->nchunks*sizeof(buddy_chunk *));
+    m += BUDDY_BIG_ROUND(bh->nchunks*sizeof(buddy_chunk *));
+    words = BV_SIZE(bh->nchunks);
+    for(o=0;o<=bh->orders;o++) {
+        bh->hasfree[o] = (bv_type) m;
+        bv_clearall(bh->hasfree[o],bh->nchunks);
+        m += BUDDY_BIG_ROUND(words*sizeof(BV_TYPE));
+    }
+    m = (char *) metadata+BUDDY_BIG_METADATASIZE(size,chunksize)-BUDDY_METADATASIZE(size,chunksize);
+    if( buddy_heap_init(&bh->top,base,size,chunksize,m) < 0 )
+        return -1;
+    bh->recpages = 0;
+    bh->nsplit = 0;
+    return 0;
+}
+
+/**
+ *  @brief  buddy_big_alloc
+ */
+void *
+buddy_big_alloc(buddy_bigheap *bh, size_t size) {
+buddy_chunk *c;
+void *p;
+int o,k;
+
+    o = order(bh,size);
+    if( o >= bh->orders )
+        return buddy_heap_alloc(&bh->top,size);
+    k = bv_findnextset(bh->hasfree[o],0,bh->nchunks);
+    if( k >= 0 )
+        c = bh->chunks[k];
+    else if( (c = newchunk(bh)) == 0 )
+        return 0;
+    p = buddy_heap_alloc(&c->heap,size);
+    if( p )
+        c->used++;
+    update(bh,c);
+    return p;
+}
+
+/**
+ *  @brief  buddy_big_free
+ */
+void
+buddy_big_free(buddy_bigheap *bh, void *addr) {
+buddy_chunk *c;
+int k;
+
+    k = chunkof(bh,addr);
+    if( k < 0 )
+        return;
+    c = bh->chunks[k];
+    if( c == 0 ) {
+        buddy_heap_free(&bh->top,addr);
+        return;
+    }
+    freeinchunk(bh,c,addr,0);
+}
+
+/**
+ *  @brief  buddy_big_free_sized
+ *
+ *  @note   size is the size given to buddy_big_alloc
+ */
+void
+buddy_big_free_sized(buddy_bigheap *bh, void *addr, size_t size) {
+buddy_chunk *c;
+int k;
+
+    k = chunkof(bh,addr);
+    if( k < 0 )
+        return;
+    c = bh->chunks[k];
+    if( c == 0 ) {
+        buddy_heap_free_sized(&bh->top,addr,size);
+        return;
+    }
+    freeinchunk(bh,c,addr,size);
+}
+
+/**
+ *  @brief  buddy_big_usable_size
+ */
+size_t
+buddy_big_usable_size(buddy_bigheap *bh, void *addr) {
+int k;
+
+    k = chunkof(bh,addr);
+    if( k < 0 )
+        return 0;
+    if( bh->chunks[k] )
+        return buddy_heap_usable_size(&bh->chunks[k]->heap,addr);
+    return buddy_heap_usable_size(&bh->top,addr);
+}
+
+/**
+ *  @brief  buddy_big_stats
+ *
+ *  @note   free and largest count the free chunks and the free blocks of the
+ *          chunks that are split, visiting them. The counters (with BUDDY_STATS)
+ *          are those of the top heap, where a split chunk or a record page is a
+ *          block in use.
+ */
+void
+buddy_big_stats(buddy_bigheap *bh, buddy_statistics *stats) {
+buddy_statistics cs;
+int k;
+
+    buddy_heap_stats(&bh->top,stats);
+    for(k=0;k<bh->nchunks;k++) {
+        if( bh->chunks[k] == 0 )
+            continue;
+        buddy_heap_stats(&bh->chunks[k]->heap,&cs);
+        stats->free += cs.free;
+        if( cs.largest > stats->largest )
+            stats->largest = cs.largest;
+    }
+    stats->fragmentation = stats->free ? (int) (1000-(stats->largest*1000)/stats->free) : 0;
+}
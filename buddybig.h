@@ -0,0 +1,99 @@
+#ifndef BUDDYBIG_H
+#define BUDDYBIG_H
+/**
+ *  @file   buddybig.h
+ *
+ *  @note   Two level heap for large areas with small blocks: a heap of chunks
+ *          and a heap inside each chunk that is split
+ */
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Upper limit for the number of orders of the blocks inside a chunk
+#ifndef BUDDY_BIG_MAXORDERS
+#define BUDDY_BIG_MAXORDERS     24
+#endif
+
+/**
+ *  @brief  Heap of a chunk
+ *
+ *  @note   Records are carved from chunks of the heap (record pages), with the
+ *          metadata of the heap after the record.
+ */
+typedef struct buddy_chunk {
+    buddy_heap          heap;               ///< heap of the blocks of the chunk
+    struct buddy_chunk *next;               ///< next free record of its page
+    int                 index;              ///< number of the chunk
+    int                 largest;            ///< order of the largest free block or -1
+    int                 used;               ///< blocks in use
+} buddy_chunk;
+
+/**
+ *  @brief  Header of a record page
+ *
+ *  @note   The records follow it. They are carved when first needed, and the
+ *          page goes back to the heap of chunks when none is in use.
+ */
+typedef struct buddy_recpage {
+    struct buddy_recpage *next;             ///< next page with free records
+    struct buddy_recpage *prev;             ///< previous page with free records
+    buddy_chunk          *freerecs;         ///< free records
+    int                   carved;           ///< records carved
+    int                   inuse;            ///< records in use
+} buddy_recpage;
+
+/**
+ *  @brief  Two level heap
+ *
+ *  @note   hasfree[o] has a bit set for each chunk with a free block of order o
+ *          or larger (order 0 is the smallest block), so a chunk for a request
+ *          is found by a search of a bitmap, as the free blocks of a level.
+ */
+typedef struct {
+    buddy_heap          top;                ///< heap of chunks
+    size_t              chunksize;          ///< size of a chunk (power of 2)
+    int                 chunkshift;         ///< log2 of chunksize
+    int                 nchunks;            ///< number of chunks
+    int                 orders;             ///< orders of the blocks smaller than a chunk
+    size_t              minsize;            ///< minimal size of a block
+    int                 minshift;           ///< log2 of minsize
+    size_t              recsize;            ///< size of a record with its metadata
+    int                 recsperpage;        ///< records of a record page
+    buddy_chunk       **chunks;             ///< heap of each chunk or 0
+    bv_type             hasfree[BUDDY_BIG_MAXORDERS]; ///< chunks with free blocks per order
+    buddy_recpage      *recpages;           ///< record pages with free records
+    int                 nsplit;             ///< chunks with a heap
+} buddy_bigheap;
+
+/**
+ *  @brief  Size of the metadata of a two level heap
+ *
+ *  @note   The parts are aligned to a cache line. The metadata of the heaps of
+ *          the chunks is not included: it is taken from the area when needed.
+ */
+///@{
+#define BUDDY_BIG_ROUND(X)      (((X)+63)&~(size_t) 63)
+#define BUDDY_BIG_METADATASIZE(SIZE,CHUNKSIZE) \
+        (BUDDY_BIG_ROUND((SIZE)/(CHUNKSIZE)*sizeof(buddy_chunk *)) \
+         +BUDDY_BIG_MAXORDERS*BUDDY_BIG_ROUND(BV_SIZE((SIZE)/(CHUNKSIZE))*sizeof(BV_TYPE)) \
+         +BUDDY_METADATASIZE(SIZE,CHUNKSIZE))
+///@}
+
+int   buddy_big_init(buddy_bigheap *bh, void *base, size_t size, size_t chunksize,
+                     size_t minsize, void *metadata);
+void *buddy_big_alloc(buddy_bigheap *bh, size_t size);
+void  buddy_big_free(buddy_bigheap *bh, void *addr);
+void  buddy_big_free_sized(buddy_bigheap *bh, void *addr, size_t size);
+size_t buddy_big_usable_size(buddy_bigheap *bh, void *addr);
+void  buddy_big_stats(buddy_bigheap *bh, buddy_statistics *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
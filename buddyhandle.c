@@ -0,0 +1,209 @@
+/**
+ *  @file   buddyhandle.c
+ *
+ *  @note   Blocks reached through handles, that can be moved to compact a heap
+ *
+ *  @note
+ *    A block allocated through a handle is only known by the entry of its handle,
+ *    so it can be moved: the data is copied to a new block and the entry is
+ *    updated. The user gets the address from the handle when needed, or pins the
+ *    handle while the address is kept.
+ *
+ *    A compaction looks at the handles from where the last one stopped, and for
+ *    each block asks the heap for the free block of its size with the lowest
+ *    address (BUDDY_POLICY_ADDRESS). If that block is below the one in use, the
+ *    data is moved there. The blocks in use are so packed at the start of the
+ *    area, and the free blocks left at the end are merged into large blocks.
+ *    The time is checked every few handles, so a compaction can be called from
+ *    an idle loop with a small budget and go on in the next calls.
+ *
+ *    The handles of a heap are used by a single thread, or under one lock that
+ *    also covers the heap itself, since a compaction allocates and frees in it.
+ *    pins and the entries are plain fields, so pin and unpin take that lock too.
+ *    An address got without a pin is only valid until the next compaction, also
+ *    for another thread that read it under the lock.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "buddyhandle.h"
+
+/// Handles looked at between readings of the clock
+#define BUDDY_HANDLE_STEP       16
+
+/**
+ *  @brief  elapsed
+ *
+ *  @note   returns the microseconds since start
+ */
+static unsigned long
+elapsed(const struct timespec *start) {
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long) (ts.tv_sec-start->tv_sec)*1000000UL+
+           (ts.tv_nsec-start->tv_nsec)/1000;
+}
+
+/**
+ *  @brief  move
+ *
+ *  @note   moves the block of e to the free block with the lowest address. Returns
+ *          1 if it was moved or 0 if there is no free block below it.
+ *
+ *  @note   with BUDDY_LAZY the heap is merged first, as the last block freed
+ *          would be taken before the one with the lowest address
+ */
+static int
+move(buddy_handleheap *hh, buddy_handleentry *e) {
+char *p;
+int policy;
+
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(hh->heap);
+#endif
+    policy = buddy_heap_setpolicy(hh->heap,BUDDY_POLICY_ADDRESS);
+    p = (char *) buddy_heap_alloc(hh->heap,e->size);
+    (void) buddy_heap_setpolicy(hh->heap,policy);
+    if( p == 0 )
+        return 0;
+    if( p > e->addr ) {
+        buddy_heap_free_sized(hh->heap,p,e->size);
+        return 0;
+    }
+    memcpy(p,e->addr,e->size);
+    buddy_heap_free_sized(hh->heap,e->addr,e->size);
+    e->addr = p;
+    hh->moves++;
+    hh->moved += e->size;
+    return 1;
+}
+
+/**
+ *  @brief  buddy_handle_init
+ *
+ *  @note   the blocks are allocated from heap. table must have nhandles entries
+ */
+void
+buddy_handle_init(buddy_handleheap *hh, buddy_heap *heap, buddy_handleentry *table,
+                  int nhandles) {
+int i;
+
+    hh->heap = heap;
+    hh->table = table;
+    hh->nhandles = nhandles;
+    for(i=0;i<nhandles;i++) {
+        table[i].addr = 0;
+        table[i].size = 0;
+        table[i].pins = 0;
+        table[i].next = i+1 < nhandles ? i+1 : -1;
+    }
+    hh->freelist = nhandles > 0 ? 0 : -1;
+    hh->cursor = 0;
+    hh->moves = 0;
+    hh->moved = 0;
+}
+
+/**
+ *  @brief  buddy_handle_alloc
+ *
+ *  @note   returns the handle of a new block or BUDDY_HANDLE_NULL if there is no
+ *          free handle or block
+ */
+buddy_handle
+buddy_handle_alloc(buddy_handleheap *hh, size_t size) {
+buddy_handleentry *e;
+int h;
+
+    h = hh->freelist;
+    if( h < 0 )
+        return BUDDY_HANDLE_NULL;
+    e = &hh->table[h];
+    e->addr = (char *) buddy_heap_alloc(hh->heap,size);
+    if( e->addr == 0 )
+        return BUDDY_HANDLE_NULL;
+    hh->freelist = e->next;
+    e->size = size;
+    e->pins = 0;
+    return h;
+}
+
+/**
+ *  @brief  buddy_handle_free
+ */
+void
+buddy_handle_free(buddy_handleheap *hh, buddy_handle h) {
+buddy_handleentry *e;
+
+    if( (h < 0) || (h >= hh->nhandles) || (hh->table[h].addr == 0) )
+        return;
+    e = &hh->table[h];
+    buddy_heap_free_sized(hh->heap,e->addr,e->size);
+    e->addr = 0;
+    e->next = hh->freelist;
+    hh->freelist = h;
+}
+
+/**
+ *  @brief  buddy_handle_pin
+ *
+ *  @note   returns the address of the block of h, that is not moved until the
+ *          same number of calls to buddy_handle_unpin
+ */
+void *
+buddy_handle_pin(buddy_handleheap *hh, buddy_handle h) {
+    if( (h < 0) || (h >= hh->nhandles) )
+        return 0;
+    hh->table[h].pins++;
+    return hh->table[h].addr;
+}
+
+/**
+ *  @brief  buddy_handle_unpin
+ */
+void
+buddy_handle_unpin(buddy_handleheap *hh, buddy_handle h) {
+    if( (h >= 0) && (h < hh->nhandles) && (hh->table[h].pins > 0) )
+        hh->table[h].pins--;
+}
+
+/**
+ *  @brief  buddy_handle_compact
+ *
+ *  @note   moves blocks of the handles not pinned to lower addresses, for about
+ *          budget microseconds (0 for no limit), starting at the handle after the
+ *          last one looked at by the previous call. It stops after looking at all
+ *          the handles once. Returns the number of blocks moved.
+ *
+ *  @note   with BUDDY_LAZY the heap is merged at the end, so the blocks freed
+ *          are part of the large free blocks formed
+ */
+int
+buddy_handle_compact(buddy_handleheap *hh, unsigned budget) {
+struct timespec start;
+buddy_handleentry *e;
+int i,n;
+
+    if( hh->nhandles == 0 )
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    n = 0;
+    for(i=0;i<hh->nhandles;i++) {
+        if( budget && (i%BUDDY_HANDLE_STEP == BUDDY_HANDLE_STEP-1) &&
+            (elapsed(&start) >= budget) )
+            break;
+        e = &hh->table[hh->cursor];
+        if( ++hh->cursor == hh->nhandles )
+            hh->cursor = 0;
+        if( (e->addr == 0) || (e->pins > 0) )
+            continue;
+        n += move(hh,e);
+    }
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(hh->heap);
+#endif
+    return n;
+}
@@ -0,0 +1,76 @@
+#ifndef BUDDYHANDLE_H
+#define BUDDYHANDLE_H
+/**
+ *  @file   buddyhandle.h
+ *
+ *  @note   Blocks reached through handles, that can be moved to compact a heap
+ */
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Handle of a movable block
+ *
+ *  @note   An index in the table of handles
+ */
+///@{
+typedef int buddy_handle;
+/// Handle of an allocation that failed
+#define BUDDY_HANDLE_NULL       (-1)
+///@}
+
+/**
+ *  @brief  Entry of the table of handles
+ */
+typedef struct {
+    char               *addr;               ///< block, or 0 when the handle is free
+    size_t              size;               ///< size requested
+    int                 pins;               ///< the block is not moved while not 0
+    int                 next;               ///< next free handle
+} buddy_handleentry;
+
+/**
+ *  @brief  Heap of movable blocks
+ *
+ *  @note   The table is given by the caller. The heap can also have blocks
+ *          allocated directly, that are never moved.
+ */
+typedef struct {
+    buddy_heap         *heap;               ///< heap of the blocks
+    buddy_handleentry  *table;              ///< handles
+    int                 nhandles;           ///< number of handles
+    int                 freelist;           ///< first free handle or -1
+    int                 cursor;             ///< next handle looked at by a compaction
+    unsigned long       moves;              ///< blocks moved
+    unsigned long long  moved;              ///< bytes moved
+} buddy_handleheap;
+
+void  buddy_handle_init(buddy_handleheap *hh, buddy_heap *heap, buddy_handleentry *table,
+                        int nhandles);
+buddy_handle buddy_handle_alloc(buddy_handleheap *hh, size_t size);
+void  buddy_handle_free(buddy_handleheap *hh, buddy_handle h);
+void *buddy_handle_pin(buddy_handleheap *hh, buddy_handle h);
+void  buddy_handle_unpin(buddy_handleheap *hh, buddy_handle h);
+int   buddy_handle_compact(buddy_handleheap *hh, unsigned budget);
+
+/**
+ *  @brief  buddy_handle_ptr
+ *
+ *  @note   returns the address of the block of h, valid until the next call
+ *          to buddy_handle_compact unless the handle is pinned
+ */
+static inline void *
+buddy_handle_ptr(const buddy_handleheap *hh, buddy_handle h) {
+    return h == BUDDY_HANDLE_NULL ? (void *) 0 : (void *) hh->table[h].addr;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
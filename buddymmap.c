@@ -0,0 +1,211 @@
+/**
+ *  @file   buddymmap.c
+ *
+ *  @note   Heap in an area mapped from the system
+ *
+ *  @note
+ *    The area is reserved with an anonymous mapping without swap reservation
+ *    (MAP_NORESERVE), so the system gives it pages only when they are touched.
+ *    Since the metadata is in its own mapping and buddy.c never writes to the
+ *    free blocks, a page is touched only after a block with it is allocated,
+ *    and the resident size follows the blocks in use.
+ *
+ *    The pages are given back by the purge of buddy.c: when a free forms a free
+ *    block of at least a page (a huge page with BUDDY_MMAP_HUGETLB or
+ *    BUDDY_MMAP_THP), the block is released with madvise(MADV_DONTNEED), or
+ *    MADV_FREE with BUDDY_MMAP_LAZYFREE. Since each block is purged once when
+ *    it is formed, larger merges do not purge the same pages again. Smaller
+ *    free blocks keep their pages.
+ *
+ *    The base of the area is aligned to a huge page when the area has one, so
+ *    the kernel can back it with transparent huge pages.
+ *
+ *    The heap is locked by the caller like any other. The purge runs inside the
+ *    free that forms the block, under that lock, so the madvise calls and the
+ *    counters purges and purged need no lock of their own, but the lock is held
+ *    during the system call. buddy_mmap_resident only asks the system about the
+ *    pages and can be called at any time.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "buddymmap.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE   0
+#endif
+
+/**
+ *  @brief  purge
+ *
+ *  @note   gives back the pages of a free block. The size is rounded up to a
+ *          page, that is only needed at the end of the area
+ */
+static void
+purge(void *addr, size_t size, void *arg) {
+buddy_mmapheap *mh = (buddy_mmapheap *) arg;
+size_t n = (size+mh->pagesize-1)&~(mh->pagesize-1);
+
+#ifdef MADV_FREE
+    // Not supported by huge pages of the pool
+    if( (mh->flags&BUDDY_MMAP_LAZYFREE) && (madvise(addr,n,MADV_FREE) == 0) ) {
+        mh->purges++;
+        mh->purged += n;
+        return;
+    }
+#endif
+    if( madvise(addr,n,MADV_DONTNEED) == 0 ) {
+        mh->purges++;
+        mh->purged += n;
+    }
+}
+
+/**
+ *  @brief  maparea
+ *
+ *  @note   maps size bytes aligned to align (a multiple of the page size).
+ *          Returns 0 if it fails
+ */
+static char *
+maparea(size_t size, size_t align, int flags) {
+char *p;
+size_t extra;
+
+    p = (char *) mmap(0,size+align,PROT_READ|PROT_WRITE,flags,-1,0);
+    if( p == (char *) MAP_FAILED )
+        return 0;
+    extra = (align-((uintptr_t) p&(align-1)))&(align-1);
+    if( extra )
+        (void) munmap(p,extra);
+    if( align-extra )
+        (void) munmap(p+extra+size,align-extra);
+    return p+extra;
+}
+
+/**
+ *  @brief  buddy_heap_create_mmap
+ *
+ *  @note   maps an area of size bytes (rounded down to a multiple of minsize) and
+ *          initializes a heap on it. Returns the heap or 0 if the sizes are not
+ *          valid or the mapping fails (e.g. with BUDDY_MMAP_HUGETLB, when the
+ *          pool has not enough huge pages)
+ */
+buddy_heap *
+buddy_heap_create_mmap(size_t size, size_t minsize, int flags) {
+buddy_mmapheap *mh;
+size_t page,align,header,mapsize,areasize;
+char *area;
+int mflags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+
+    if( (minsize == 0) || (minsize&(minsize-1)) || (minsize > size) )
+        return 0;
+    size -= size&(minsize-1);
+    page = (size_t) sysconf(_SC_PAGESIZE);
+
+    // This structure and the metadata, aligned to a cache line
+    header = (sizeof(buddy_mmapheap)+63)&~(size_t) 63;
+    mapsize = (header+BUDDY_METADATASIZE(size,minsize)+page-1)&~(page-1);
+    mh = (buddy_mmapheap *) mmap(0,mapsize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if( mh == (buddy_mmapheap *) MAP_FAILED )
+        return 0;
+
+    align = page;
+    if( flags&BUDDY_MMAP_HUGETLB ) {
+#ifdef MAP_HUGETLB
+        // Huge pages of the pool are already aligned
+        page = BUDDY_HUGEPAGESIZE;
+        align = page;
+        areasize = (size+page-1)&~(page-1);
+        area = (char *) mmap(0,areasize,PROT_READ|PROT_WRITE,mflags|MAP_HUGETLB,-1,0);
+        if( area == (char *) MAP_FAILED )
+            area = 0;
+#else
+        area = 0;
+#endif
+    } else {
+        if( flags&BUDDY_MMAP_THP )
+            page = BUDDY_HUGEPAGESIZE;
+        if( (flags&BUDDY_MMAP_THP) || (size >= BUDDY_HUGEPAGESIZE) )
+            align = BUDDY_HUGEPAGESIZE;
+        areasize = (size+page-1)&~(page-1);
+        area = maparea(areasize,align,mflags);
+#ifdef MADV_HUGEPAGE
+        if( area && (flags&BUDDY_MMAP_THP) )
+            (void) madvise(area,areasize,MADV_HUGEPAGE);
+#endif
+    }
+    if( area == 0 ) {
+        (void) munmap(mh,mapsize);
+        return 0;
+    }
+
+    if( buddy_heap_init(&mh->heap,area,size,minsize,(char *) mh+header) < 0 ) {
+        (void) munmap(area,areasize);
+        (void) munmap(mh,mapsize);
+        return 0;
+    }
+    mh->area = area;
+    mh->areasize = areasize;
+    mh->mapsize = mapsize;
+    mh->pagesize = page;
+    mh->flags = flags;
+    mh->purges = 0;
+    mh->purged = 0;
+    if( (flags&BUDDY_MMAP_NOPURGE) == 0 )
+        (void) buddy_heap_setpurge(&mh->heap,page > minsize ? page : minsize,purge,mh);
+    return &mh->heap;
+}
+
+/**
+ *  @brief  buddy_heap_destroy_mmap
+ *
+ *  @note   unmaps the area and the metadata of a heap made by
+ *          buddy_heap_create_mmap
+ */
+void
+buddy_heap_destroy_mmap(buddy_heap *heap) {
+buddy_mmapheap *mh = (buddy_mmapheap *) heap;
+char *area = mh->area;
+size_t areasize = mh->areasize;
+
+    (void) munmap(area,areasize);
+    (void) munmap(mh,mh->mapsize);
+}
+
+/**
+ *  @brief  buddy_mmap_resident
+ *
+ *  @note   returns the bytes of the pages of the range that are resident (the
+ *          whole area when addr is 0), as given by mincore
+ */
+size_t
+buddy_mmap_resident(buddy_heap *heap, void *addr, size_t size) {
+buddy_mmapheap *mh = (buddy_mmapheap *) heap;
+unsigned char vec[256];
+size_t page,n,i,count;
+uintptr_t start,end;
+
+    if( addr == 0 ) {
+        addr = mh->area;
+        size = mh->heap.size;
+    }
+    page = (size_t) sysconf(_SC_PAGESIZE);
+    start = (uintptr_t) addr&~(page-1);
+    end = ((uintptr_t) addr+size+page-1)&~(page-1);
+    count = 0;
+    while( start < end ) {
+        n = (end-start)/page;
+        if( n > sizeof(vec) )
+            n = sizeof(vec);
+        if( mincore((void *) start,n*page,vec) < 0 )
+            break;
+        for(i=0;i<n;i++)
+            count += vec[i]&1;
+        start += n*page;
+    }
+    return count*page;
+}
@@ -0,0 +1,62 @@
+#ifndef BUDDYMMAP_H
+#define BUDDYMMAP_H
+/**
+ *  @file   buddymmap.h
+ *
+ *  @note   Heap in an area mapped from the system, with the pages of free blocks
+ *          given back
+ */
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Flags of buddy_heap_create_mmap
+ */
+///@{
+/// Huge pages of the pool of the system (MAP_HUGETLB)
+#define BUDDY_MMAP_HUGETLB      1
+/// Transparent huge pages (MADV_HUGEPAGE)
+#define BUDDY_MMAP_THP          2
+/// Purge with MADV_FREE, so the pages are taken only under memory pressure
+#define BUDDY_MMAP_LAZYFREE     4
+/// Do not purge the free blocks
+#define BUDDY_MMAP_NOPURGE      8
+///@}
+
+/// Size of a huge page
+#ifndef BUDDY_HUGEPAGESIZE
+#define BUDDY_HUGEPAGESIZE      (2*1024*1024)
+#endif
+
+/**
+ *  @brief  Heap in a mapped area
+ *
+ *  @note   buddy_heap_create_mmap returns the address of heap, so a
+ *          buddy_heap * of it can be converted to a buddy_mmapheap *. This
+ *          structure and the metadata are in their own mapping.
+ */
+typedef struct {
+    buddy_heap          heap;               ///< heap (must be the first)
+    char               *area;               ///< mapping of the area
+    size_t              areasize;           ///< size of the mapping of the area
+    size_t              mapsize;            ///< size of the mapping of this structure
+    size_t              pagesize;           ///< size of a page of the area
+    int                 flags;              ///< BUDDY_MMAP_HUGETLB, ...
+    unsigned long       purges;             ///< number of purges
+    unsigned long long  purged;             ///< bytes purged
+} buddy_mmapheap;
+
+buddy_heap *buddy_heap_create_mmap(size_t size, size_t minsize, int flags);
+void  buddy_heap_destroy_mmap(buddy_heap *heap);
+size_t buddy_mmap_resident(buddy_heap *heap, void *addr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,285 @@
+/**
+ *  @file   buddymt.c
+ *
+ *  @note   Thread safe front end for a buddy heap
+ *
+ *  @note
+ *    Each thread has a cache with one magazine of free blocks for each of the
+ *    BUDDY_MT_CACHELEVELS lowest levels (order 0 is the smallest block). An
+ *    allocation takes a block from the magazine of its order and a free puts it
+ *    back there, without touching the shared heap.
+ *
+ *    When a magazine is empty, it is refilled with BUDDY_MT_MAGAZINE/2 blocks
+ *    allocated from the heap in bulk while holding the lock. When it is full, the
+ *    same number of blocks (the oldest ones) is drained back with a bulk free.
+ *
+ *    Larger blocks go straight to the heap under the lock.
+ *
+ *    The blocks in the caches are allocated as far as the heap is concerned, so
+ *    they are not merged until drained. A thread returns its cache to the heap
+ *    when it exits or when it calls buddy_mt_flush.
+ *
+ *    A cache keeps the generation of the heap of its blocks. After
+ *    buddy_heap_reset (under the lock), the next call of each thread sees that
+ *    it changed and empties the magazines without freeing their blocks, that
+ *    the reset already made free.
+ */
+
+#include <stdlib.h>
+
+#include "buddymt.h"
+
+/**
+ *  @brief  Magazine of free blocks of an order
+ */
+typedef struct {
+    int         count;                      ///< number of blocks
+    void       *blocks[BUDDY_MT_MAGAZINE];  ///< blocks (last is the most recent)
+} magazine;
+
+/**
+ *  @brief  Cache of a thread
+ */
+typedef struct {
+    buddy_mtheap   *mt;                     ///< owner
+    unsigned        generation;             ///< of the heap when the blocks were taken
+    magazine        mag[BUDDY_MT_CACHELEVELS];
+} threadcache;
+
+/**
+ *  @brief  order of a request (0 for the smallest block)
+ */
+static inline int
+order(buddy_heap *heap, size_t size) {
+    if( size <= heap->minsize )
+        return 0;
+    return bv_log2((size-1)>>heap->minshift)+1;
+}
+
+/**
+ *  @brief  drain
+ *
+ *  @note   returns the n oldest blocks of a magazine to the heap
+ */
+static void
+drain(buddy_mtheap *mt, magazine *m, int n) {
+int i;
+
+    if( n > m->count )
+        n = m->count;
+    pthread_mutex_lock(&mt->lock);
+    buddy_heap_free_bulk(mt->heap,m->blocks,n);
+    pthread_mutex_unlock(&mt->lock);
+    for(i=n;i<m->count;i++)
+        m->blocks[i-n] = m->blocks[i];
+    m->count -= n;
+}
+
+/**
+ *  @brief  checkgeneration
+ *
+ *  @note   empties the magazines of c if the heap was reset since their blocks
+ *          were taken. The generation is written under the lock and read here
+ *          without it.
+ */
+static inline void
+checkgeneration(threadcache *c) {
+unsigned g;
+int o;
+
+#ifdef BV_HASATOMICS
+    g = BV_ATOMIC_LOADX(&c->mt->heap->generation,BV_RELAXED);
+#else
+    g = c->mt->heap->generation;
+#endif
+    if( c->generation == g )
+        return;
+    for(o=0;o<BUDDY_MT_CACHELEVELS;o++)
+        c->mag[o].count = 0;
+    c->generation = g;
+}
+
+/**
+ *  @brief  flushcache
+ */
+static void
+flushcache(threadcache *c) {
+int o;
+
+    checkgeneration(c);
+    for(o=0;o<BUDDY_MT_CACHELEVELS;o++)
+        drain(c->mt,&c->mag[o],c->mag[o].count);
+}
+
+/**
+ *  @brief  destructor of the thread cache
+ */
+static void
+destroycache(void *p) {
+threadcache *c = p;
+
+    flushcache(c);
+    free(c);
+}
+
+/**
+ *  @brief  getcache
+ *
+ *  @note   returns the cache of calling thread, creating it if needed.
+ *          Returns 0 if it can not be created.
+ */
+static threadcache *
+getcache(buddy_mtheap *mt) {
+threadcache *c;
+
+    c = pthread_getspecific(mt->key);
+    if( c ) {
+        checkgeneration(c);
+        return c;
+    }
+    c = calloc(1,sizeof(threadcache));
+    if( c == 0 )
+        return 0;
+    c->mt = mt;
+    c->generation = mt->heap->generation;
+    if( pthread_setspecific(mt->key,c) ) {
+        free(c);
+        return 0;
+    }
+    return c;
+}
+
+/**
+ *  @brief  buddy_mt_init
+ *
+ *  @note   heap must be already initialized. Returns 0 if OK
+ */
+int
+buddy_mt_init(buddy_mtheap *mt, buddy_heap *heap) {
+
+    mt->heap = heap;
+    if( pthread_mutex_init(&mt->lock,0) )
+        return -1;
+    if( pthread_key_create(&mt->key,destroycache) ) {
+        pthread_mutex_destroy(&mt->lock);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *  @brief  buddy_mt_destroy
+ *
+ *  @note   the cache of the calling thread is flushed. Other threads must
+ *          have exited or called buddy_mt_flush before.
+ */
+void
+buddy_mt_destroy(buddy_mtheap *mt) {
+threadcache *c;
+
+    c = pthread_getspecific(mt->key);
+    if( c ) {
+        pthread_setspecific(mt->key,0);
+        destroycache(c);
+    }
+    pthread_key_delete(mt->key);
+    pthread_mutex_destroy(&mt->lock);
+}
+
+/**
+ *  @brief  buddy_mt_alloc
+ */
+void *
+buddy_mt_alloc(buddy_mtheap *mt, size_t size) {
+threadcache *c;
+magazine *m;
+size_t s;
+void *p;
+int o;
+
+    o = order(mt->heap,size);
+    if( (o < BUDDY_MT_CACHELEVELS) && (c = getcache(mt)) ) {
+        m = &c->mag[o];
+        if( m->count > 0 )
+            return m->blocks[--m->count];
+        // Refill
+        s = mt->heap->minsize<<o;
+        pthread_mutex_lock(&mt->lock);
+        m->count = buddy_heap_alloc_bulk(mt->heap,s,BUDDY_MT_MAGAZINE/2,m->blocks);
+        pthread_mutex_unlock(&mt->lock);
+        if( m->count > 0 )
+            return m->blocks[--m->count];
+        // Blocks kept by this thread may be merged to attend the request
+        flushcache(c);
+    }
+
+    pthread_mutex_lock(&mt->lock);
+    p = buddy_heap_alloc(mt->heap,size);
+    pthread_mutex_unlock(&mt->lock);
+    return p;
+}
+
+/**
+ *  @brief  buddy_mt_free_sized
+ *
+ *  @note   size must be the one used in the allocation (or any size that
+ *          rounds to the same block)
+ */
+void
+buddy_mt_free_sized(buddy_mtheap *mt, void *addr, size_t size) {
+threadcache *c;
+magazine *m;
+int o;
+
+    if( addr == 0 )
+        return;
+    o = order(mt->heap,size);
+    if( (o < BUDDY_MT_CACHELEVELS) && (c = getcache(mt)) ) {
+        m = &c->mag[o];
+        if( m->count == BUDDY_MT_MAGAZINE )
+            drain(mt,m,BUDDY_MT_MAGAZINE/2);
+        m->blocks[m->count++] = addr;
+        return;
+    }
+
+    pthread_mutex_lock(&mt->lock);
+    buddy_heap_free_sized(mt->heap,addr,size);
+    pthread_mutex_unlock(&mt->lock);
+}
+
+/**
+ *  @brief  buddy_mt_free
+ *
+ *  @note   the size of the block is found in the heap under the lock. Use
+ *          buddy_mt_free_sized when it is known.
+ */
+void
+buddy_mt_free(buddy_mtheap *mt, void *addr) {
+size_t size;
+
+    if( addr == 0 )
+        return;
+    pthread_mutex_lock(&mt->lock);
+    size = buddy_heap_usable_size(mt->heap,addr);
+    if( (size == 0) || (order(mt->heap,size) >= BUDDY_MT_CACHELEVELS) ) {
+        buddy_heap_free(mt->heap,addr);
+        pthread_mutex_unlock(&mt->lock);
+        return;
+    }
+    pthread_mutex_unlock(&mt->lock);
+    buddy_mt_free_sized(mt,addr,size);
+}
+
+/**
+ *  @brief  buddy_mt_flush
+ *
+ *  @note   returns all blocks in the cache of the calling thread to the heap
+ */
+void
+buddy_mt_flush(buddy_mtheap *mt) {
+threadcache *c;
+
+    c = pthread_getspecific(mt->key);
+    if( c )
+        flushcache(c);
+}
@@ -0,0 +1,54 @@
+#ifndef BUDDYMT_H
+#define BUDDYMT_H
+/**
+ *  @file   buddymt.h
+ *
+ *  @note   Thread safe front end for a buddy heap with per thread caches
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Cache parameters
+ */
+///@{
+/// Number of levels (from the smallest block size up) that are cached
+#ifndef BUDDY_MT_CACHELEVELS
+#define BUDDY_MT_CACHELEVELS    8
+#endif
+/// Number of blocks in a magazine. Refills and drains move half of it
+#ifndef BUDDY_MT_MAGAZINE
+#define BUDDY_MT_MAGAZINE       16
+#endif
+///@}
+
+/**
+ *  @brief  Thread safe heap
+ *
+ *  @note   The heap is shared and protected by lock. Each thread has a cache
+ *          with a magazine of free blocks for each of the lowest levels.
+ */
+typedef struct {
+    buddy_heap         *heap;               ///< shared heap
+    pthread_mutex_t     lock;               ///< protects heap
+    pthread_key_t       key;                ///< cache of the calling thread
+} buddy_mtheap;
+
+int   buddy_mt_init(buddy_mtheap *mt, buddy_heap *heap);
+void  buddy_mt_destroy(buddy_mtheap *mt);
+void *buddy_mt_alloc(buddy_mtheap *mt, size_t size);
+void  buddy_mt_free(buddy_mtheap *mt, void *addr);
+void  buddy_mt_free_sized(buddy_mtheap *mt, void *addr, size_t size);
+void  buddy_mt_flush(buddy_mtheap *mt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,133 @@
+#ifndef BUDDYPMR_HPP
+#define BUDDYPMR_HPP
+/**
+ *  @file   buddypmr.hpp
+ *
+ *  @note   std::pmr::memory_resource and STL allocator over buddy heaps (C++17)
+ *
+ *  @note
+ *    buddy_memory_resource uses a heap, that must not be used by other threads at
+ *    the same time, and buddy_mt_memory_resource a thread safe heap. Both free with
+ *    the size given to do_deallocate, so there is no search for the block.
+ *
+ *    The alignment is obtained from the heap: a block is aligned to its size
+ *    relative to the base of the heap. buddy_memory_resource uses
+ *    buddy_heap_alloc_aligned, so any alignment (2^n) can be attended.
+ *    buddy_mt_memory_resource asks for a block of at least align bytes, that is
+ *    aligned when the base is. When they can not attend a request, they throw
+ *    std::bad_alloc.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+#include "buddy.h"
+#include "buddymt.h"
+
+namespace buddy {
+
+/**
+ *  @brief  Memory resource over a heap
+ */
+class buddy_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit buddy_memory_resource(buddy_heap *heap) : heap_(heap) {}
+    buddy_heap *heap() const { return heap_; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+        void *p = buddy_heap_alloc_aligned(heap_,bytes ? bytes : 1,align);
+        if( p == 0 )
+            throw std::bad_alloc();
+        return p;
+    }
+    void do_deallocate(void *p, size_t bytes, size_t) override {
+        buddy_heap_free_sized(heap_,p,bytes ? bytes : 1);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const buddy_memory_resource *r = dynamic_cast<const buddy_memory_resource *>(&other);
+        return (r != 0) && (r->heap_ == heap_);
+    }
+
+private:
+    buddy_heap *heap_;
+};
+
+/**
+ *  @brief  Memory resource over a thread safe heap
+ */
+class buddy_mt_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit buddy_mt_memory_resource(buddy_mtheap *mt) : mt_(mt) {}
+    buddy_mtheap *mtheap() const { return mt_; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+        size_t n = bytes > align ? bytes : align;
+        void *p = buddy_mt_alloc(mt_,n ? n : 1);
+        if( p == 0 )
+            throw std::bad_alloc();
+        if( reinterpret_cast<uintptr_t>(p)&(align-1) ) {
+            // The base of the heap is not aligned enough
+            buddy_mt_free_sized(mt_,p,n ? n : 1);
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        size_t n = bytes > align ? bytes : align;
+        buddy_mt_free_sized(mt_,p,n ? n : 1);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const buddy_mt_memory_resource *r = dynamic_cast<const buddy_mt_memory_resource *>(&other);
+        return (r != 0) && (r->mt_ == mt_);
+    }
+
+private:
+    buddy_mtheap *mt_;
+};
+
+/**
+ *  @brief  STL allocator over a heap
+ *
+ *  @note   For containers that do not use std::pmr
+ */
+template<class T>
+class buddy_stl_allocator {
+public:
+    typedef T value_type;
+
+    explicit buddy_stl_allocator(buddy_heap *heap) noexcept : heap_(heap) {}
+    template<class U>
+    buddy_stl_allocator(const buddy_stl_allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    T *allocate(size_t n) {
+        void *p = buddy_heap_alloc_aligned(heap_,n*sizeof(T),alignof(T));
+        if( p == 0 )
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t n) noexcept {
+        buddy_heap_free_sized(heap_,p,n*sizeof(T));
+    }
+    buddy_heap *heap() const noexcept { return heap_; }
+
+private:
+    buddy_heap *heap_;
+};
+
+template<class T, class U>
+bool operator==(const buddy_stl_allocator<T> &a, const buddy_stl_allocator<U> &b) noexcept {
+    return a.heap() == b.heap();
+}
+
+template<class T, class U>
+bool operator!=(const buddy_stl_allocator<T> &a, const buddy_stl_allocator<U> &b) noexcept {
+    return a.heap() != b.heap();
+}
+
+}
+
+#endif
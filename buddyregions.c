@@ -0,0 +1,178 @@
+/**
+ *  @file   buddyregions.c
+ *
+ *  @note   Allocation from a set of regions, preferring the nearest ones
+ *
+ *  @note
+ *    Each region is a heap with its own area and metadata, tagged with the node
+ *    where it is (a NUMA node, or a kind of memory such as TCM, SRAM or DDR) and a
+ *    priority. An allocation for a node tries the regions in order of distance from
+ *    that node and, at the same distance, in order of priority. The distances are
+ *    |from-to| unless set by buddy_regions_distance.
+ *
+ *    The order of the regions for each node is computed when the set changes, so
+ *    an allocation just walks a list. A free finds the region by the address.
+ *
+ *    A set has no lock. buddy_regions_alloc may go through several heaps before
+ *    one has room, so the caller serializes the calls on a set with one lock.
+ *    Since the heaps are independent, a free can instead take a lock per region:
+ *    buddy_regions_heapof only reads the set, and the heap it returns is freed
+ *    with buddy_heap_free under the lock of that region. buddy_regions_add and
+ *    buddy_regions_distance rebuild the orders, so they need the lock of the set
+ *    and no free running.
+ */
+
+#include <stddef.h>
+
+#include "buddyregions.h"
+
+/**
+ *  @brief  before
+ *
+ *  @note   returns a non zero value if region a must be tried before b by node n
+ */
+static int
+before(buddy_regionset *rs, int n, int a, int b) {
+buddy_region *ra = &rs->regions[a];
+buddy_region *rb = &rs->regions[b];
+int da = rs->distance[n][ra->node];
+int db = rs->distance[n][rb->node];
+
+    if( da != db )
+        return da < db;
+    if( ra->priority != rb->priority )
+        return ra->priority < rb->priority;
+    return a < b;
+}
+
+/**
+ *  @brief  sortregions
+ *
+ *  @note   builds the order of the regions for each node (insertion sort)
+ */
+static void
+sortregions(buddy_regionset *rs) {
+int n,i,j;
+
+    for(n=0;n<BUDDY_MAXNODES;n++) {
+        for(i=0;i<rs->nregions;i++) {
+            for(j=i;(j > 0) && before(rs,n,i,rs->order[n][j-1]);j--)
+                rs->order[n][j] = rs->order[n][j-1];
+            rs->order[n][j] = (unsigned char) i;
+        }
+    }
+}
+
+/**
+ *  @brief  buddy_regions_init
+ */
+void
+buddy_regions_init(buddy_regionset *rs) {
+int i,j;
+
+    rs->nregions = 0;
+    for(i=0;i<BUDDY_MAXNODES;i++) {
+        for(j=0;j<BUDDY_MAXNODES;j++)
+            rs->distance[i][j] = (unsigned char) (i > j ? i-j : j-i);
+    }
+}
+
+/**
+ *  @brief  buddy_regions_add
+ *
+ *  @note   heap must be already initialized. Returns the number of the region
+ *          or -1 if the set is full or node is not valid.
+ */
+int
+buddy_regions_add(buddy_regionset *rs, buddy_heap *heap, int node, int priority) {
+buddy_region *r;
+
+    if( (rs->nregions == BUDDY_MAXREGIONS) || (node < 0) || (node >= BUDDY_MAXNODES) )
+        return -1;
+    r = &rs->regions[rs->nregions++];
+    r->heap = heap;
+    r->node = node;
+    r->priority = priority;
+    sortregions(rs);
+    return rs->nregions-1;
+}
+
+/**
+ *  @brief  buddy_regions_distance
+ *
+ *  @note   sets the distance from node from to node to (0 to 255). Returns 0 if
+ *          OK or -1 if a node is not valid.
+ */
+int
+buddy_regions_distance(buddy_regionset *rs, int from, int to, int distance) {
+
+    if( (from < 0) || (from >= BUDDY_MAXNODES) || (to < 0) || (to >= BUDDY_MAXNODES) )
+        return -1;
+    if( (distance < 0) || (distance > 255) )
+        return -1;
+    rs->distance[from][to] = (unsigned char) distance;
+    sortregions(rs);
+    return 0;
+}
+
+/**
+ *  @brief  buddy_regions_alloc
+ *
+ *  @note   allocates from the nearest region of node that has room
+ */
+void *
+buddy_regions_alloc(buddy_regionset *rs, size_t size, int node) {
+void *p;
+int i;
+
+    if( (node < 0) || (node >= BUDDY_MAXNODES) )
+        return 0;
+    for(i=0;i<rs->nregions;i++) {
+        p = buddy_heap_alloc(rs->regions[rs->order[node][i]].heap,size);
+        if( p )
+            return p;
+    }
+    return 0;
+}
+
+/**
+ *  @brief  buddy_regions_heapof
+ *
+ *  @note   returns the heap whose area contains addr or 0 if there is none
+ */
+buddy_heap *
+buddy_regions_heapof(buddy_regionset *rs, void *addr) {
+buddy_heap *heap;
+int i;
+
+    for(i=0;i<rs->nregions;i++) {
+        heap = rs->regions[i].heap;
+        if( ((char *) addr >= heap->base) && ((char *) addr < heap->base+heap->size) )
+            return heap;
+    }
+    return 0;
+}
+
+/**
+ *  @brief  buddy_regions_free
+ */
+void
+buddy_regions_free(buddy_regionset *rs, void *addr) {
+buddy_heap *heap;
+
+    heap = buddy_regions_heapof(rs,addr);
+    if( heap )
+        buddy_heap_free(heap,addr);
+}
+
+/**
+ *  @brief  buddy_regions_free_sized
+ */
+void
+buddy_regions_free_sized(buddy_regionset *rs, void *addr, size_t size) {
+buddy_heap *heap;
+
+    heap = buddy_regions_heapof(rs,addr);
+    if( heap )
+        buddy_heap_free_sized(heap,addr,size);
+}
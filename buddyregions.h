@@ -0,0 +1,66 @@
+#ifndef BUDDYREGIONS_H
+#define BUDDYREGIONS_H
+/**
+ *  @file   buddyregions.h
+ *
+ *  @note   Front end for a set of heaps in different memory regions or nodes
+ */
+
+#include <stddef.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Limits
+ */
+///@{
+/// Number of regions in a set
+#ifndef BUDDY_MAXREGIONS
+#define BUDDY_MAXREGIONS    16
+#endif
+/// Number of nodes (0 to BUDDY_MAXNODES-1)
+#ifndef BUDDY_MAXNODES
+#define BUDDY_MAXNODES      8
+#endif
+///@}
+
+/**
+ *  @brief  Region
+ *
+ *  @note   Each region has its own heap, so regions do not share metadata
+ */
+typedef struct {
+    buddy_heap     *heap;                   ///< heap of the region
+    int             node;                   ///< node where it is
+    int             priority;               ///< order among regions at the same distance
+} buddy_region;
+
+/**
+ *  @brief  Set of regions
+ *
+ *  @note   order has, for each node, the regions sorted by distance from it and
+ *          then by priority (lower first)
+ */
+typedef struct {
+    int             nregions;               ///< number of regions
+    buddy_region    regions[BUDDY_MAXREGIONS];
+    unsigned char   distance[BUDDY_MAXNODES][BUDDY_MAXNODES];
+    unsigned char   order[BUDDY_MAXNODES][BUDDY_MAXREGIONS];
+} buddy_regionset;
+
+void  buddy_regions_init(buddy_regionset *rs);
+int   buddy_regions_add(buddy_regionset *rs, buddy_heap *heap, int node, int priority);
+int   buddy_regions_distance(buddy_regionset *rs, int from, int to, int distance);
+void *buddy_regions_alloc(buddy_regionset *rs, size_t size, int node);
+void  buddy_regions_free(buddy_regionset *rs, void *addr);
+void  buddy_regions_free_sized(buddy_regionset *rs, void *addr, size_t size);
+buddy_heap *buddy_regions_heapof(buddy_regionset *rs, void *addr);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,204 @@
+/**
+ *  @file   buddyshm.c
+ *
+ *  @note   Heap shared by processes
+ *
+ *  @note
+ *    A segment of shared memory (POSIX or SysV shared memory, or a mapped file)
+ *    has a header with a lock, the image of a heap (buddy_heap_format) and the
+ *    area. Each process maps it at its own address and has a buddy_shmheap with
+ *    the addresses of its mapping. Blocks are given as offsets from the base of
+ *    the area, that mean the same in all processes.
+ *
+ *    The heap structure is in the segment, so its counters and lists are shared,
+ *    but its pointers are those of the last process that used it. An operation
+ *    takes the lock and, if the base is not the one of the caller, sets them for
+ *    its mapping (buddy_heap_rebase), which takes a constant time.
+ *
+ *    The lock is a robust mutex. When a process dies holding it, the heap may be
+ *    in the middle of an operation: the next process that takes the lock repairs
+ *    it with buddy_heap_check. The routines without lock of BUDDY_ATOMIC can not
+ *    be used, since they would use the pointers of another process.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+
+#include "buddyshm.h"
+
+/**
+ *  @brief  lock
+ *
+ *  @note   takes the lock of the segment, repairs the heap if its owner died and
+ *          sets the pointers of the heap for the caller. Returns the heap or 0
+ *
+ *  @note   the mutex is made consistent before any return. When the heap can not
+ *          be rebased (an image of another configuration), it is marked damaged
+ *          and repaired by the next process that can.
+ */
+static buddy_heap *
+lock(buddy_shmheap *sh) {
+buddy_image *im = (buddy_image *) sh->image;
+int r;
+
+    r = pthread_mutex_lock(&sh->seg->lock);
+    if( (r != 0) && (r != EOWNERDEAD) )
+        return 0;
+    if( im->heap.base != sh->area ) {
+        if( buddy_heap_rebase(im,sh->area) == 0 ) {
+            // Left for the next process that can rebase it
+            if( r == EOWNERDEAD ) {
+                sh->seg->damaged = 1;
+                (void) pthread_mutex_consistent(&sh->seg->lock);
+            }
+            (void) pthread_mutex_unlock(&sh->seg->lock);
+            return 0;
+        }
+    }
+    if( (r == EOWNERDEAD) || sh->seg->damaged ) {
+        (void) buddy_heap_check(&im->heap,1);
+        sh->seg->repairs++;
+        sh->seg->damaged = 0;
+    }
+    if( r == EOWNERDEAD )
+        (void) pthread_mutex_consistent(&sh->seg->lock);
+    return &im->heap;
+}
+
+/**
+ *  @brief  unlock
+ */
+static inline void
+unlock(buddy_shmheap *sh) {
+    (void) pthread_mutex_unlock(&sh->seg->lock);
+}
+
+/**
+ *  @brief  buddy_shm_format
+ *
+ *  @note   initializes a segment with an area of size bytes. segment must have
+ *          BUDDY_SHM_SEGMENTSIZE(size,minsize) bytes, aligned to a page, and
+ *          no other process may use it yet. Returns 0 if OK or -1
+ */
+int
+buddy_shm_format(buddy_shmheap *sh, void *segment, size_t size, size_t minsize) {
+buddy_shmsegment *seg = (buddy_shmsegment *) segment;
+pthread_mutexattr_t attr;
+char *image = (char *) segment+BUDDY_SHM_HEADER;
+char *area = (char *) segment+BUDDY_SHM_AREAOFFSET(size,minsize);
+
+    if( buddy_heap_format(image,area,size,minsize) == 0 )
+        return -1;
+    if( pthread_mutexattr_init(&attr) != 0 )
+        return -1;
+    if( (pthread_mutexattr_setpshared(&attr,PTHREAD_PROCESS_SHARED) != 0) ||
+        (pthread_mutexattr_setrobust(&attr,PTHREAD_MUTEX_ROBUST) != 0) ||
+        (pthread_mutex_init(&seg->lock,&attr) != 0) ) {
+        (void) pthread_mutexattr_destroy(&attr);
+        return -1;
+    }
+    (void) pthread_mutexattr_destroy(&attr);
+    memcpy(seg->magic,"BSHM",4);
+    seg->image = (uint64_t) (image-(char *) segment);
+    seg->area = (uint64_t) (area-(char *) segment);
+    seg->repairs = 0;
+    seg->damaged = 0;
+    BV_ATOMIC_STOREX(&seg->ready,1,BV_RELEASE);
+
+    sh->seg = seg;
+    sh->image = image;
+    sh->area = area;
+    return 0;
+}
+
+/**
+ *  @brief  buddy_shm_attach
+ *
+ *  @note   attaches a process to a segment formatted by another one, mapped at
+ *          any address. Returns 0 if OK or -1 if the segment is not formatted
+ *          or its heap was made with other compile options
+ */
+int
+buddy_shm_attach(buddy_shmheap *sh, void *segment) {
+buddy_shmsegment *seg = (buddy_shmsegment *) segment;
+
+    if( (BV_ATOMIC_LOADX(&seg->ready,BV_ACQUIRE) != 1) || memcmp(seg->magic,"BSHM",4) )
+        return -1;
+    sh->seg = seg;
+    sh->image = (char *) segment+seg->image;
+    sh->area = (char *) segment+seg->area;
+    if( lock(sh) == 0 )
+        return -1;
+    unlock(sh);
+    return 0;
+}
+
+/**
+ *  @brief  buddy_shm_alloc
+ *
+ *  @note   returns the offset of a block of at least size bytes or BUDDY_SHM_NULL
+ */
+buddy_shmoff
+buddy_shm_alloc(buddy_shmheap *sh, size_t size) {
+buddy_heap *heap;
+void *p;
+
+    heap = lock(sh);
+    if( heap == 0 )
+        return BUDDY_SHM_NULL;
+    p = buddy_heap_alloc(heap,size);
+    unlock(sh);
+    return buddy_shm_offset(sh,p);
+}
+
+/**
+ *  @brief  buddy_shm_free
+ *
+ *  @note   frees the block at offset off, allocated by any process
+ */
+void
+buddy_shm_free(buddy_shmheap *sh, buddy_shmoff off) {
+buddy_heap *heap;
+
+    if( off == BUDDY_SHM_NULL )
+        return;
+    heap = lock(sh);
+    if( heap == 0 )
+        return;
+    buddy_heap_free(heap,sh->area+off);
+    unlock(sh);
+}
+
+/**
+ *  @brief  buddy_shm_free_sized
+ */
+void
+buddy_shm_free_sized(buddy_shmheap *sh, buddy_shmoff off, size_t size) {
+buddy_heap *heap;
+
+    if( off == BUDDY_SHM_NULL )
+        return;
+    heap = lock(sh);
+    if( heap == 0 )
+        return;
+    buddy_heap_free_sized(heap,sh->area+off,size);
+    unlock(sh);
+}
+
+/**
+ *  @brief  buddy_shm_stats
+ */
+void
+buddy_shm_stats(buddy_shmheap *sh, buddy_statistics *stats) {
+buddy_heap *heap;
+
+    heap = lock(sh);
+    if( heap == 0 ) {
+        memset(stats,0,sizeof(*stats));
+        return;
+    }
+    buddy_heap_stats(heap,stats);
+    unlock(sh);
+}
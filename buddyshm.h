@@ -0,0 +1,98 @@
+#ifndef BUDDYSHM_H
+#define BUDDYSHM_H
+/**
+ *  @file   buddyshm.h
+ *
+ *  @note   Heap in a segment of shared memory, used by several processes
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Offset of a block from the base of the area
+ *
+ *  @note   Blocks are passed between processes as offsets, since each process
+ *          can map the segment at another address
+ */
+///@{
+typedef uint64_t buddy_shmoff;
+/// Offset of an allocation that failed
+#define BUDDY_SHM_NULL          ((buddy_shmoff) -1)
+///@}
+
+/**
+ *  @brief  Layout of a segment
+ *
+ *  @note   The header, the image of the heap and the area, aligned to a page or
+ *          to the minimal size of a block
+ */
+///@{
+#define BUDDY_SHM_ALIGN(MINSIZE)        ((MINSIZE) > 4096 ? (size_t) (MINSIZE) : (size_t) 4096)
+#define BUDDY_SHM_HEADER                ((sizeof(buddy_shmsegment)+63)&~(size_t) 63)
+/// Offset of the area
+#define BUDDY_SHM_AREAOFFSET(SIZE,MINSIZE) \
+        ((BUDDY_SHM_HEADER+BUDDY_IMAGESIZE(SIZE,MINSIZE)+BUDDY_SHM_ALIGN(MINSIZE)-1) \
+         &~(BUDDY_SHM_ALIGN(MINSIZE)-1))
+/// Size of a segment with an area of SIZE bytes
+#define BUDDY_SHM_SEGMENTSIZE(SIZE,MINSIZE)  (BUDDY_SHM_AREAOFFSET(SIZE,MINSIZE)+(SIZE))
+///@}
+
+/**
+ *  @brief  Header of a segment
+ *
+ *  @note   lock is a process shared and robust mutex. When a process dies
+ *          holding it, the next one to lock it repairs the heap.
+ */
+typedef struct {
+    char                magic[4];           ///< "BSHM"
+    uint32_t            ready;              ///< 1 when formatted
+    pthread_mutex_t     lock;               ///< protects the heap
+    uint64_t            image;              ///< offset of the image of the heap
+    uint64_t            area;               ///< offset of the area
+    unsigned long       repairs;            ///< repairs after a process died with lock
+    uint32_t            damaged;            ///< the owner of lock died and the heap was not repaired
+} buddy_shmsegment;
+
+/**
+ *  @brief  Segment as mapped by a process
+ */
+typedef struct {
+    buddy_shmsegment   *seg;                ///< header
+    char               *image;              ///< image of the heap
+    char               *area;               ///< area
+} buddy_shmheap;
+
+int   buddy_shm_format(buddy_shmheap *sh, void *segment, size_t size, size_t minsize);
+int   buddy_shm_attach(buddy_shmheap *sh, void *segment);
+buddy_shmoff buddy_shm_alloc(buddy_shmheap *sh, size_t size);
+void  buddy_shm_free(buddy_shmheap *sh, buddy_shmoff off);
+void  buddy_shm_free_sized(buddy_shmheap *sh, buddy_shmoff off, size_t size);
+void  buddy_shm_stats(buddy_shmheap *sh, buddy_statistics *stats);
+
+/**
+ *  @brief  Translation between offsets and addresses of a process
+ */
+///@{
+static inline void *
+buddy_shm_ptr(const buddy_shmheap *sh, buddy_shmoff off) {
+    return off == BUDDY_SHM_NULL ? (void *) 0 : (void *) (sh->area+off);
+}
+
+static inline buddy_shmoff
+buddy_shm_offset(const buddy_shmheap *sh, const void *addr) {
+    return addr == 0 ? BUDDY_SHM_NULL : (buddy_shmoff) ((const char *) addr-sh->area);
+}
+///@}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
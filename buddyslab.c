@@ -0,0 +1,243 @@
+/**
+ *  @file   buddyslab.c
+ *
+ *  @note   Size classes for small objects on top of a buddy heap
+ *
+ *  @note
+ *    Each class has objects of a power of 2 size, from BUDDY_SLAB_MINOBJECT up to
+ *    the largest size where a slab still has BUDDY_SLAB_MINCOUNT objects. A slab is
+ *    a block of the minimal size of the heap, with a header at its start and the
+ *    objects after it, aligned to their size (relative to the base of the heap).
+ *
+ *       | next | prev | cls | nfree | freemap | pad |  obj 0 |  obj 1 | ... |
+ *
+ *    The slabs of a class with free objects are kept in a list. An allocation takes
+ *    the first free object of the first slab, found in its freemap. When the list is
+ *    empty, a new slab is allocated from the heap. A full slab leaves the list and
+ *    comes back when one of its objects is freed. When a slab becomes empty, it is
+ *    returned to the heap, unless it is the only one of its class in the list
+ *    (buddy_slab_trim returns these too). After buddy_heap_reset, the next allocation
+ *    sees that the generation of the heap changed and empties the lists.
+ *
+ *    Objects never start at the beginning of a block of the heap, because of the
+ *    header. So a free tells the objects from the blocks of the heap by the address.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "buddyslab.h"
+
+/**
+ *  @brief  size of the header of a slab with n objects
+ */
+static inline size_t
+headersize(int n) {
+    return offsetof(buddy_slab,freemap)+BV_SIZE(n)*sizeof(BV_TYPE);
+}
+
+/**
+ *  @brief  Lists of slabs with free objects
+ */
+///@{
+static inline void
+pushslab(buddy_slabclass *c, buddy_slab *s) {
+    s->prev = 0;
+    s->next = c->partial;
+    if( c->partial )
+        c->partial->prev = s;
+    c->partial = s;
+}
+
+static inline void
+removeslab(buddy_slabclass *c, buddy_slab *s) {
+    if( s->prev )
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if( s->next )
+        s->next->prev = s->prev;
+}
+///@}
+
+/**
+ *  @brief  slabof
+ *
+ *  @note   returns the slab containing addr or 0 if addr is not an object.
+ *          The index of the object is returned in *ip.
+ */
+static buddy_slab *
+slabof(buddy_slabheap *sh, void *addr, int *ip) {
+buddy_heap *heap = sh->heap;
+buddy_slabclass *c;
+buddy_slab *s;
+size_t disp;
+size_t off;
+
+    if( ((char *) addr < heap->base) || ((char *) addr >= heap->base+heap->size) )
+        return 0;
+    disp = (char *) addr-heap->base;
+    off = disp&(heap->minsize-1);
+    if( off == 0 )
+        return 0;               // Start of a block
+
+    s = (buddy_slab *) (heap->base+(disp-off));
+    if( buddy_heap_usable_size(heap,s) != heap->minsize )
+        return 0;               // Inside a larger block
+    if( (s->cls < 0) || (s->cls >= sh->nclasses) )
+        return 0;
+    c = &sh->classes[s->cls];
+    if( (off < (size_t) c->offset) || ((off-c->offset)&(c->size-1)) )
+        return 0;
+    *ip = (int) ((off-c->offset)/c->size);
+    return s;
+}
+
+/**
+ *  @brief  buddy_slab_init
+ *
+ *  @note   heap must be already initialized and its base aligned to a pointer.
+ *          Returns 0 if OK or -1 when the minimal block is too small for any
+ *          class (then all requests go to the heap).
+ */
+int
+buddy_slab_init(buddy_slabheap *sh, buddy_heap *heap) {
+buddy_slabclass *c;
+size_t size;
+int n;
+
+    sh->heap = heap;
+    sh->generation = heap->generation;
+    sh->nclasses = 0;
+    size = BUDDY_SLAB_MINOBJECT;
+    while( (sh->nclasses < BUDDY_SLAB_MAXCLASSES) && (size < heap->minsize) ) {
+        n = (int) (heap->minsize/size);
+        while( (n > 0) && (headersize(n)+n*size > heap->minsize) )
+            n--;
+        if( n < BUDDY_SLAB_MINCOUNT )
+            break;
+        c = &sh->classes[sh->nclasses++];
+        c->size = size;
+        c->count = n;
+        c->offset = (int) (heap->minsize-n*size);
+        c->partial = 0;
+        size *= 2;
+    }
+    return sh->nclasses > 0 ? 0 : -1;
+}
+
+/**
+ *  @brief  buddy_slab_alloc
+ */
+void *
+buddy_slab_alloc(buddy_slabheap *sh, size_t size) {
+buddy_slabclass *c;
+buddy_slab *s;
+int i;
+
+    if( (sh->nclasses == 0) || (size > sh->classes[sh->nclasses-1].size) )
+        return buddy_heap_alloc(sh->heap,size);
+    if( sh->generation != sh->heap->generation ) {
+        // The heap was reset, so the slabs are gone
+        for(i=0;i<sh->nclasses;i++)
+            sh->classes[i].partial = 0;
+        sh->generation = sh->heap->generation;
+    }
+
+    // Smallest class that fits
+    for(i=0;sh->classes[i].size<size;i++)
+        ;
+    c = &sh->classes[i];
+
+    s = c->partial;
+    if( s == 0 ) {
+        s = buddy_heap_alloc(sh->heap,sh->heap->minsize);
+        if( s == 0 )
+            return 0;
+        s->cls = i;
+        s->nfree = c->count;
+        bv_clearall(s->freemap,c->count);
+        bv_setrange(s->freemap,0,c->count);
+        pushslab(c,s);
+    }
+
+    i = bv_findfirstset(s->freemap,c->count);
+    bv_clear(s->freemap,i);
+    if( --s->nfree == 0 )
+        removeslab(c,s);
+    return (char *) s+c->offset+i*c->size;
+}
+
+/**
+ *  @brief  buddy_slab_free
+ *
+ *  @note   addr can be an object or a block allocated from the heap
+ */
+void
+buddy_slab_free(buddy_slabheap *sh, void *addr) {
+buddy_slabclass *c;
+buddy_slab *s;
+int i;
+
+    if( addr == 0 )
+        return;
+    s = slabof(sh,addr,&i);
+    if( s == 0 ) {
+        buddy_heap_free(sh->heap,addr);
+        return;
+    }
+    c = &sh->classes[s->cls];
+    if( bv_test(s->freemap,i) )
+        return;                 // Already free
+
+    bv_set(s->freemap,i);
+    s->nfree++;
+    if( s->nfree == 1 )
+        pushslab(c,s);
+    if( (s->nfree == c->count) && ((s->prev != 0) || (s->next != 0)) ) {
+        // Empty and not the last one of its class
+        removeslab(c,s);
+        buddy_heap_free_sized(sh->heap,s,sh->heap->minsize);
+    }
+}
+
+/**
+ *  @brief  buddy_slab_trim
+ *
+ *  @note   returns the empty slabs kept by the classes to the heap
+ */
+void
+buddy_slab_trim(buddy_slabheap *sh) {
+buddy_slabclass *c;
+buddy_slab *s,*next;
+int i;
+
+    for(i=0;i<sh->nclasses;i++) {
+        c = &sh->classes[i];
+        for(s=c->partial;s;s=next) {
+            next = s->next;
+            if( s->nfree < c->count )
+                continue;
+            removeslab(c,s);
+            buddy_heap_free_sized(sh->heap,s,sh->heap->minsize);
+        }
+    }
+}
+
+/**
+ *  @brief  buddy_slab_usable_size
+ *
+ *  @note   returns the size of the object or block at addr or 0 if there is none
+ */
+size_t
+buddy_slab_usable_size(buddy_slabheap *sh, void *addr) {
+buddy_slab *s;
+int i;
+
+    s = slabof(sh,addr,&i);
+    if( s == 0 )
+        return buddy_heap_usable_size(sh->heap,addr);
+    if( bv_test(s->freemap,i) )
+        return 0;
+    return sh->classes[s->cls].size;
+}
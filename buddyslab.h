@@ -0,0 +1,82 @@
+#ifndef BUDDYSLAB_H
+#define BUDDYSLAB_H
+/**
+ *  @file   buddyslab.h
+ *
+ *  @note   Size classes for small objects, carved from blocks of a buddy heap
+ */
+
+#include <stddef.h>
+
+#include "buddy.h"
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Size classes
+ */
+///@{
+/// Size of the objects of the first class. The others double it
+#ifndef BUDDY_SLAB_MINOBJECT
+#define BUDDY_SLAB_MINOBJECT    16
+#endif
+/// Upper limit for the number of classes
+#define BUDDY_SLAB_MAXCLASSES   16
+/// A class is used only when a slab has at least this number of objects
+#ifndef BUDDY_SLAB_MINCOUNT
+#define BUDDY_SLAB_MINCOUNT     8
+#endif
+///@}
+
+/**
+ *  @brief  Slab
+ *
+ *  @note   A slab is a block of the minimal size of the heap. This header is at
+ *          its start and the objects fill the rest of it. freemap has a bit set
+ *          for each free object.
+ */
+typedef struct buddy_slab {
+    struct buddy_slab  *next;               ///< next slab with free objects
+    struct buddy_slab  *prev;               ///< previous slab with free objects
+    int                 cls;                ///< size class
+    int                 nfree;              ///< number of free objects
+    BV_TYPE             freemap[];          ///< free objects
+} buddy_slab;
+
+/**
+ *  @brief  Size class
+ */
+typedef struct {
+    size_t          size;                   ///< size of the objects
+    int             count;                  ///< number of objects in a slab
+    int             offset;                 ///< offset of the first object
+    buddy_slab     *partial;                ///< slabs with free objects
+} buddy_slabclass;
+
+/**
+ *  @brief  Heap with size classes
+ *
+ *  @note   Requests up to the size of the largest class are attended by the
+ *          slabs. The others go straight to the heap. When the heap is reset,
+ *          the slabs are dropped.
+ */
+typedef struct {
+    buddy_heap         *heap;               ///< heap of the slabs
+    unsigned            generation;         ///< generation of the heap of the slabs
+    int                 nclasses;           ///< number of classes
+    buddy_slabclass     classes[BUDDY_SLAB_MAXCLASSES];
+} buddy_slabheap;
+
+int    buddy_slab_init(buddy_slabheap *sh, buddy_heap *heap);
+void  *buddy_slab_alloc(buddy_slabheap *sh, size_t size);
+void   buddy_slab_free(buddy_slabheap *sh, void *addr);
+size_t buddy_slab_usable_size(buddy_slabheap *sh, void *addr);
+void   buddy_slab_trim(buddy_slabheap *sh);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
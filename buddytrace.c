@@ -0,0 +1,169 @@
+/**
+ *  @file   buddytrace.c
+ *
+ *  @note   Lock free ring buffer for the trace of the operations of a heap
+ *
+ *  @note
+ *    When buddy.c is compiled with BUDDY_TRACE, each operation of a heap with a
+ *    trace (buddy_heap_settrace) writes a record here. A writer takes the number
+ *    of its record with an atomic increment of head, so writers never wait for
+ *    each other, and it uses the slot number&mask. The seq of the slot is the
+ *    number of the record while it is written and that number plus 1 after it.
+ *
+ *    The reader copies the records from tail on. A record whose seq is larger than
+ *    expected was overwritten (the ring went around) and is counted as lost. One
+ *    whose seq is smaller is not written yet, or is being written, so the reading
+ *    stops there. The seq is checked again after the copy, since a writer may
+ *    have taken the slot meanwhile.
+ *
+ *    The numbers are 32 bit and wrap around; only their differences are used, so
+ *    no value of seq is reserved and record 0xFFFFFFFF, completed with seq 0, is
+ *    read as any other. A reader must not lag 2^31 records behind the writers.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "buddytrace.h"
+
+/**
+ *  @brief  Atomic operations on 32 bit counters
+ */
+///@{
+#define LOAD(P)         BV_ATOMIC_LOADX((P),BV_ACQUIRE)
+#define STORE(P,V)      BV_ATOMIC_STOREX((P),(V),BV_RELEASE)
+#define FETCHADD(P,N)   BV_ATOMIC_ADDX((P),(N),BV_RELAXED)
+///@}
+
+/**
+ *  @brief  buddy_trace_clock
+ *
+ *  @note   returns a monotonic time in nanoseconds (0 when there is no clock)
+ */
+uint64_t
+buddy_trace_clock(void) {
+#ifdef CLOCK_MONOTONIC
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t) ts.tv_sec*1000000000ULL+ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  @brief  buddy_trace_init
+ *
+ *  @note   buffer must have BUDDY_TRACE_BUFSIZE(nslots) bytes. Returns 0 if OK
+ *          or -1 if nslots is not a power of 2
+ */
+int
+buddy_trace_init(buddy_trace *tr, void *buffer, int nslots) {
+
+    if( (nslots <= 0) || (nslots&(nslots-1)) )
+        return -1;
+    tr->slots = (buddy_traceslot *) buffer;
+    tr->mask = (uint32_t) nslots-1;
+    tr->head = 0;
+    tr->tail = 0;
+    tr->lost = 0;
+    memset(buffer,0,BUDDY_TRACE_BUFSIZE(nslots));
+    return 0;
+}
+
+/**
+ *  @brief  buddy_trace_record
+ *
+ *  @note   writes a record. align is the alignment (0 or 1 when none)
+ */
+void
+buddy_trace_record(buddy_trace *tr, int op, size_t size, uint32_t block, uint32_t old,
+                   int align) {
+buddy_traceslot *s;
+uint32_t n;
+int a;
+
+    n = FETCHADD(&tr->head,1);
+    s = &tr->slots[n&tr->mask];
+    STORE(&s->seq,n);
+    BV_ATOMIC_FENCE(BV_RELEASE);
+
+    for(a=0;(1<<a)<align;a++)
+        ;
+    s->record.time = BUDDY_TRACE_CLOCK();
+    s->record.size = size > UINT32_MAX ? UINT32_MAX : (uint32_t) size;
+    s->record.block = block;
+    s->record.old = old;
+    s->record.op = (uint8_t) op;
+    s->record.align = (uint8_t) a;
+    s->record.reserved = 0;
+    STORE(&s->seq,n+1);
+}
+
+/**
+ *  @brief  buddy_trace_read
+ *
+ *  @note   copies up to max records, the oldest first, and returns their number
+ */
+int
+buddy_trace_read(buddy_trace *tr, buddy_tracerecord *out, int max) {
+buddy_traceslot *s;
+uint32_t h,t,seq;
+int n;
+
+    n = 0;
+    t = tr->tail;
+    while( n < max ) {
+        h = LOAD(&tr->head);
+        if( t == h )
+            break;
+        if( h-t > tr->mask+1 ) {
+            // Overwritten
+            tr->lost += h-t-(tr->mask+1);
+            t = h-(tr->mask+1);
+        }
+        s = &tr->slots[t&tr->mask];
+        seq = LOAD(&s->seq);
+        if( seq != t+1 ) {
+            if( (int32_t) (seq-(t+1)) < 0 )
+                break;              // Not written yet, or being written
+            tr->lost++;
+            t++;
+            continue;
+        }
+        out[n] = s->record;
+        BV_ATOMIC_FENCE(BV_ACQUIRE);
+        if( LOAD(&s->seq) != seq ) {
+            tr->lost++;
+            t++;
+            continue;
+        }
+        n++;
+        t++;
+    }
+    tr->tail = t;
+    return n;
+}
+
+/**
+ *  @brief  buddy_trace_header
+ *
+ *  @note   fills the header of a trace file of a heap
+ */
+void
+buddy_trace_header(buddy_traceheader *hdr, buddy_heap *heap) {
+
+    memcpy(hdr->magic,"BTRC",4);
+    hdr->version = BUDDY_TRACE_VERSION;
+    hdr->size = heap->size;
+    hdr->minsize = heap->minsize;
+    for(hdr->basealign=0;hdr->basealign<63;hdr->basealign++) {
+        if( ((uintptr_t) heap->base>>hdr->basealign)&1 )
+            break;
+    }
+    hdr->reserved = 0;
+}
@@ -0,0 +1,115 @@
+#ifndef BUDDYTRACE_H
+#define BUDDYTRACE_H
+/**
+ *  @file   buddytrace.h
+ *
+ *  @note   Trace of the operations of a heap, in a lock free ring buffer
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buddy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @brief  Operations
+ */
+///@{
+#define BUDDY_TRACE_ALLOC       1           ///< allocation (block is the result)
+#define BUDDY_TRACE_FREE        2           ///< free (size is 0 if not given)
+#define BUDDY_TRACE_REALLOC     3           ///< realloc from block old to block
+#define BUDDY_TRACE_SUBTREE     4           ///< buddy_heap_free_subtree
+#define BUDDY_TRACE_RESET       5           ///< buddy_heap_reset
+/// block of an allocation that failed
+#define BUDDY_TRACE_NOBLOCK     0xFFFFFFFFU
+///@}
+
+/**
+ *  @brief  Record of an operation
+ *
+ *  @note   Blocks are given by their offset from the base of the heap, in blocks
+ *          of the minimal size, so a trace does not depend on the addresses.
+ *          Sizes above 4 GBytes are saturated. A trace file has a header and
+ *          the records, in the byte order of the machine.
+ */
+typedef struct {
+    uint64_t    time;                       ///< timestamp (ns with the default clock)
+    uint32_t    size;                       ///< requested size
+    uint32_t    block;                      ///< block (offset in minimal blocks)
+    uint32_t    old;                        ///< previous block of a realloc
+    uint8_t     op;                         ///< BUDDY_TRACE_ALLOC, ...
+    uint8_t     align;                      ///< log2 of the alignment requested
+    uint16_t    reserved;
+} buddy_tracerecord;
+
+/**
+ *  @brief  Header of a trace file
+ */
+typedef struct {
+    char        magic[4];                   ///< "BTRC"
+    uint32_t    version;                    ///< BUDDY_TRACE_VERSION
+    uint64_t    size;                       ///< size of the heap
+    uint64_t    minsize;                    ///< minimal size of a block
+    uint32_t    basealign;                  ///< log2 of the alignment of the base
+    uint32_t    reserved;
+} buddy_traceheader;
+
+#define BUDDY_TRACE_VERSION     1
+
+/**
+ *  @brief  Slot of the ring buffer
+ *
+ *  @note   seq is the number of the record plus 1 when it is written, and the
+ *          number itself while it is being written
+ */
+typedef struct {
+    uint32_t            seq;
+    uint32_t            pad;
+    buddy_tracerecord   record;
+} buddy_traceslot;
+
+/**
+ *  @brief  Ring buffer
+ *
+ *  @note   Any number of threads can write to it. When it is full, the oldest
+ *          records are overwritten and counted as lost by the reader, that
+ *          must be one at a time.
+ */
+typedef struct buddy_trace {
+    buddy_traceslot    *slots;              ///< buffer given by the caller
+    uint32_t            mask;               ///< number of slots-1
+    uint32_t            head;               ///< number of the next record written
+    uint32_t            tail;               ///< number of the next record read
+    uint32_t            lost;               ///< records overwritten before read
+} buddy_trace;
+
+/// Size of the buffer of a ring with N slots (a power of 2)
+#define BUDDY_TRACE_BUFSIZE(N)  ((N)*sizeof(buddy_traceslot))
+
+/**
+ *  @brief  Clock
+ *
+ *  @note   Define BUDDY_TRACE_CLOCK() as an expression of type uint64_t, e.g.
+ *          a cycle counter, where there is no clock_gettime
+ */
+///@{
+#ifndef BUDDY_TRACE_CLOCK
+#define BUDDY_TRACE_CLOCK()     buddy_trace_clock()
+#endif
+uint64_t buddy_trace_clock(void);
+///@}
+
+int   buddy_trace_init(buddy_trace *tr, void *buffer, int nslots);
+void  buddy_trace_record(buddy_trace *tr, int op, size_t size, uint32_t block,
+                         uint32_t old, int align);
+int   buddy_trace_read(buddy_trace *tr, buddy_tracerecord *out, int max);
+void  buddy_trace_header(buddy_traceheader *hdr, buddy_heap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,557 @@
+/**
+ *  @file  replaybuddy.c
+ *
+ *  @note  Replay of a trace recorded with BUDDY_TRACE
+ *
+ *  @note
+ *    The operations of a trace file (see buddytrace.h) are applied in order, as
+ *    fast as possible, to an allocator: the buddy heap (with free or sized free),
+ *    the size classes of buddyslab.c, or the C library malloc. The heap can have
+ *    a size or a minimal size other than the one recorded, so the same workload
+ *    can be tried with different geometries.
+ *
+ *    Each operation is timed with a monotonic clock. At the end, the latency
+ *    percentiles of alloc and free are reported, with the peak of the bytes
+ *    requested, the peak footprint (the end of the highest block allocated, from
+ *    the base of the heap) and the allocations that failed in the replay but not
+ *    in the trace. With -i n, the state of the heap (bytes in blocks, free bytes,
+ *    largest free block and fragmentation) is printed every n operations, with
+ *    the time of the operation in the trace.
+ *
+ *    The blocks of the trace are mapped to the ones of the replay by a hash
+ *    table. Allocations that failed in the trace are not replayed. A release of
+ *    a subtree or a reset frees the blocks of the replay one by one. The area of
+ *    the heap is aligned as the one recorded (up to 2 MBytes), so that aligned
+ *    requests are attended the same way.
+ *
+ *    The placement policy of the heap is chosen with -p.
+ *
+ *  Usage: replaybuddy [-a allocator] [-p policy] [-s heapsize] [-m minsize] [-i interval]
+ *                     tracefile
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buddy.h"
+#include "buddyslab.h"
+#include "buddytrace.h"
+
+/**
+ *  @brief  Records read at a time
+ */
+#define CHUNK       4096
+
+/**
+ *  @brief  Allocator under test
+ */
+typedef struct {
+    const char *name;
+    void      *(*alloc)(size_t size, size_t align);
+    void       (*free)(void *p, size_t size);
+    void      *(*realloc)(void *p, size_t old, size_t size);
+    int         isheap;             ///< allocates from heap
+} allocator;
+
+/**
+ *  @brief  Samples of an operation
+ */
+typedef struct {
+    uint32_t   *ns;                 ///< latency of each operation
+    long        count;
+    long        max;                ///< room in ns
+    double      total;              ///< total time in ns
+} samples;
+
+static buddy_heap heap;
+static buddy_slabheap slabheap;
+static char *heaparea;
+static void *heapmetadata;
+
+/**
+ *  @brief  Allocators
+ */
+///@{
+static void *heapalloc(size_t size, size_t align) {
+    return align > 1 ? buddy_heap_alloc_aligned(&heap,size,align) : buddy_heap_alloc(&heap,size);
+}
+static void  heapfree(void *p, size_t size) { (void) size; buddy_heap_free(&heap,p); }
+static void  heapfreesized(void *p, size_t size) { buddy_heap_free_sized(&heap,p,size); }
+static void *heaprealloc(void *p, size_t old, size_t size) {
+    (void) old;
+    return buddy_heap_realloc(&heap,p,size);
+}
+
+static void *slaballoc(size_t size, size_t align) {
+    if( align > 1 )
+        return buddy_heap_alloc_aligned(&heap,size,align);
+    return buddy_slab_alloc(&slabheap,size);
+}
+static void  slabfree(void *p, size_t size) { (void) size; buddy_slab_free(&slabheap,p); }
+static void *slabrealloc(void *p, size_t old, size_t size) {
+void *q;
+
+    q = buddy_slab_alloc(&slabheap,size);
+    if( q ) {
+        memcpy(q,p,old < size ? old : size);
+        buddy_slab_free(&slabheap,p);
+    }
+    return q;
+}
+
+static void *libcalloc(size_t size, size_t align) {
+void *p;
+
+    if( align <= sizeof(void *) )
+        return malloc(size);
+    return posix_memalign(&p,align,size) ? 0 : p;
+}
+static void  libcfree(void *p, size_t size) { (void) size; free(p); }
+static void *libcrealloc(void *p, size_t old, size_t size) { (void) old; return realloc(p,size); }
+
+static allocator allocators[] = {
+    { "buddy",       heapalloc,  heapfree,       heaprealloc,  1 },
+    { "buddy_sized", heapalloc,  heapfreesized,  heaprealloc,  1 },
+    { "slab",        slaballoc,  slabfree,       slabrealloc,  1 },
+    { "malloc",      libcalloc,  libcfree,       libcrealloc,  0 },
+};
+#define NALLOCATORS ((int) (sizeof(allocators)/sizeof(allocators[0])))
+///@}
+
+/**
+ *  @brief  Placement policies (-p)
+ */
+static const char *policies[] = { "firstfit", "bestfit", "address", "topdown" };
+#define NPOLICIES   ((int) (sizeof(policies)/sizeof(policies[0])))
+static int policy = BUDDY_POLICY_FIRSTFIT;
+
+/**
+ *  @brief  Map from the blocks of the trace to the blocks of the replay
+ *
+ *  @note   Open addressing with linear probing. A removal shifts back the
+ *          entries that follow, so there are no tombstones.
+ */
+///@{
+typedef struct {
+    uint32_t    key;                ///< block in the trace (BUDDY_TRACE_NOBLOCK if empty)
+    void       *p;                  ///< block in the replay
+    size_t      size;               ///< requested size
+} entry;
+
+static entry *table;
+static uint32_t tablemask;
+
+static inline uint32_t
+slot(uint32_t key) {
+    return (key*2654435761U)&tablemask;
+}
+
+static entry *
+lookup(uint32_t key) {
+uint32_t i;
+
+    for(i=slot(key);table[i].key!=BUDDY_TRACE_NOBLOCK;i=(i+1)&tablemask) {
+        if( table[i].key == key )
+            return &table[i];
+    }
+    return 0;
+}
+
+static void
+insert(uint32_t key, void *p, size_t size) {
+uint32_t i;
+
+    for(i=slot(key);table[i].key!=BUDDY_TRACE_NOBLOCK;i=(i+1)&tablemask) {
+        if( table[i].key == key )
+            break;
+    }
+    table[i].key = key;
+    table[i].p = p;
+    table[i].size = size;
+}
+
+static void
+removeentry(entry *e) {
+uint32_t i,j,h;
+
+    i = (uint32_t) (e-table);
+    j = i;
+    for(;;) {
+        table[i].key = BUDDY_TRACE_NOBLOCK;
+        // Move back an entry of the run that can not be reached from its slot
+        for(;;) {
+            j = (j+1)&tablemask;
+            if( table[j].key == BUDDY_TRACE_NOBLOCK )
+                return;
+            h = slot(table[j].key);
+            if( ((j-h)&tablemask) >= ((j-i)&tablemask) )
+                break;
+        }
+        table[i] = table[j];
+        i = j;
+    }
+}
+///@}
+
+/**
+ *  @brief  Replay state
+ */
+///@{
+static allocator *alloc;
+static samples sa,sf;
+static size_t requested;            ///< bytes requested in live blocks
+static size_t peakrequested;
+static size_t peakfootprint;
+static long failures;
+static long ops;
+static int maxfragmentation;
+///@}
+
+/**
+ *  @brief  now
+ *
+ *  @note   returns a monotonic time in nanoseconds
+ */
+static inline uint64_t
+now(void) {
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t) ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/**
+ *  @brief  addsample
+ */
+static void
+addsample(samples *s, uint64_t ns) {
+
+    if( s->count == s->max ) {
+        s->max = s->max ? 2*s->max : 65536;
+        s->ns = realloc(s->ns,s->max*sizeof(uint32_t));
+        if( s->ns == 0 ) {
+            fprintf(stderr,"Not enough memory\n");
+            exit(1);
+        }
+    }
+    s->ns[s->count++] = (uint32_t) ns;
+    s->total += (double) ns;
+}
+
+/**
+ *  @brief  Accounting of the live blocks
+ */
+///@{
+static void
+allocated(void *p, size_t size) {
+size_t end;
+
+    requested += size;
+    if( requested > peakrequested )
+        peakrequested = requested;
+    if( alloc->isheap ) {
+        end = (size_t) ((char *) p-heaparea)+size;
+        if( end > peakfootprint )
+            peakfootprint = end;
+    }
+}
+
+static void
+released(entry *e) {
+uint64_t t0;
+
+    requested -= e->size;
+    t0 = now();
+    alloc->free(e->p,e->size);
+    addsample(&sf,now()-t0);
+}
+///@}
+
+/**
+ *  @brief  replay
+ *
+ *  @note   applies a record of a trace whose minimal size is minshift
+ */
+static void
+replay(buddy_tracerecord *r, int minshift) {
+uint64_t t0,ns;
+uint32_t i,span;
+size_t align;
+entry *e;
+void *p;
+
+    switch( r->op ) {
+    case BUDDY_TRACE_ALLOC:
+        if( r->block == BUDDY_TRACE_NOBLOCK )
+            break;              // Failed in the trace
+        align = ((size_t) 1)<<r->align;
+        t0 = now();
+        p = alloc->alloc(r->size,align);
+        addsample(&sa,now()-t0);
+        if( p == 0 ) {
+            failures++;
+            break;
+        }
+        insert(r->block,p,r->size);
+        allocated(p,r->size);
+        break;
+
+    case BUDDY_TRACE_FREE:
+        e = lookup(r->block);
+        if( e == 0 )
+            break;
+        released(e);
+        removeentry(e);
+        break;
+
+    case BUDDY_TRACE_REALLOC:
+        e = r->old == BUDDY_TRACE_NOBLOCK ? 0 : lookup(r->old);
+        if( (e == 0) || (r->size == 0) ) {
+            if( e ) {
+                released(e);
+                removeentry(e);
+            } else if( r->block != BUDDY_TRACE_NOBLOCK ) {
+                r->op = BUDDY_TRACE_ALLOC;
+                r->align = 0;
+                replay(r,minshift);
+            }
+            break;
+        }
+        if( r->block == BUDDY_TRACE_NOBLOCK )
+            break;              // Failed in the trace, the block is kept
+        t0 = now();
+        p = alloc->realloc(e->p,e->size,r->size);
+        ns = now()-t0;
+        addsample(&sa,ns);
+        requested -= e->size;
+        if( p == 0 ) {
+            // The block is kept, under its new number in the trace
+            failures++;
+            p = e->p;
+            r->size = (uint32_t) e->size;
+        }
+        removeentry(e);
+        insert(r->block,p,r->size);
+        allocated(p,r->size);
+        break;
+
+    case BUDDY_TRACE_SUBTREE:
+    case BUDDY_TRACE_RESET:
+        span = 1;
+        while( ((size_t) span<<minshift) < r->size )
+            span *= 2;
+        for(i=0;i<=tablemask;) {
+            e = &table[i];
+            if( (e->key != BUDDY_TRACE_NOBLOCK) &&
+                ((r->op == BUDDY_TRACE_RESET) || (e->key-r->block < span)) ) {
+                released(e);
+                removeentry(e);
+                continue;       // Another entry may have moved here
+            }
+            i++;
+        }
+        break;
+    }
+}
+
+/**
+ *  @brief  sample
+ *
+ *  @note   prints the state of the heap after the operation at time t
+ */
+static void
+sample(uint64_t t) {
+buddy_statistics st;
+
+    if( !alloc->isheap ) {
+        printf("%ld,%llu,%lu,,,,\n",ops,(unsigned long long) t,(unsigned long) requested);
+        return;
+    }
+    buddy_heap_stats(&heap,&st);
+    if( st.fragmentation > maxfragmentation )
+        maxfragmentation = st.fragmentation;
+    printf("%ld,%llu,%lu,%lu,%lu,%lu,%d\n",ops,(unsigned long long) t,
+           (unsigned long) requested,(unsigned long) (st.size-st.free),
+           (unsigned long) st.free,(unsigned long) st.largest,st.fragmentation);
+}
+
+/**
+ *  @brief  compare32
+ */
+static int
+compare32(const void *a, const void *b) {
+uint32_t x = *(const uint32_t *) a;
+uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  percentile
+ *
+ *  @note   samples must be sorted. p in per thousand
+ */
+static uint32_t
+percentile(samples *s, int p) {
+long i;
+
+    if( s->count == 0 )
+        return 0;
+    i = (s->count*p)/1000;
+    if( i >= s->count )
+        i = s->count-1;
+    return s->ns[i];
+}
+
+/**
+ *  @brief  report
+ */
+static void
+report(const char *op, samples *s) {
+double opspersec;
+
+    qsort(s->ns,s->count,sizeof(uint32_t),compare32);
+    opspersec = s->total > 0 ? s->count*1e9/s->total : 0;
+    printf("%s,%ld,%.0f,%u,%u,%u,%u\n",op,s->count,opspersec,
+           percentile(s,500),percentile(s,990),percentile(s,999),
+           s->count ? s->ns[s->count-1] : 0);
+}
+
+/**
+ *  @brief  usage
+ */
+static void
+usage(const char *prog) {
+int i;
+
+    fprintf(stderr,"Usage: %s [-a allocator] [-p policy] [-s heapsize] [-m minsize] [-i interval]\n"
+                   "          tracefile\n",prog);
+    fprintf(stderr,"Allocators:");
+    for(i=0;i<NALLOCATORS;i++)
+        fprintf(stderr," %s",allocators[i].name);
+    fprintf(stderr,"\nPolicies:");
+    for(i=0;i<NPOLICIES;i++)
+        fprintf(stderr," %s",policies[i]);
+    fprintf(stderr,"\n");
+}
+
+/**
+ *  @brief  replay program
+ */
+int
+main(int argc, char *argv[])
+{
+static buddy_tracerecord records[CHUNK];
+buddy_traceheader hdr;
+const char *aname = "buddy";
+const char *pname = 0;
+size_t heapsize = 0;
+size_t minsize = 0;
+long interval = 0;
+long nrecords;
+size_t align;
+int opt,i,n,minshift;
+uint32_t cap;
+FILE *f;
+
+    while( (opt = getopt(argc,argv,"a:p:s:m:i:h")) != -1 ) {
+        switch(opt) {
+        case 'a': aname = optarg;                       break;
+        case 'p': pname = optarg;                       break;
+        case 's': heapsize = strtoul(optarg,0,0);       break;
+        case 'm': minsize = strtoul(optarg,0,0);        break;
+        case 'i': interval = atol(optarg);              break;
+        default:  usage(argv[0]);                       return 1;
+        }
+    }
+    if( optind != argc-1 ) {
+        usage(argv[0]);
+        return 1;
+    }
+    for(i=0;i<NALLOCATORS;i++) {
+        if( strcmp(aname,allocators[i].name) == 0 )
+            alloc = &allocators[i];
+    }
+    for(i=0;pname && (i<NPOLICIES);i++) {
+        if( strcmp(pname,policies[i]) == 0 )
+            break;
+    }
+    if( (alloc == 0) || (i == NPOLICIES) ) {
+        usage(argv[0]);
+        return 1;
+    }
+    if( pname )
+        policy = i;
+
+    f = fopen(argv[optind],"rb");
+    if( f == 0 ) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if( (fread(&hdr,sizeof(hdr),1,f) != 1) || memcmp(hdr.magic,"BTRC",4) ||
+        (hdr.version != BUDDY_TRACE_VERSION) ) {
+        fprintf(stderr,"%s: not a trace file\n",argv[optind]);
+        return 1;
+    }
+    fseek(f,0,SEEK_END);
+    nrecords = (ftell(f)-(long) sizeof(hdr))/(long) sizeof(buddy_tracerecord);
+    fseek(f,sizeof(hdr),SEEK_SET);
+    for(minshift=0;(((uint64_t) 1)<<minshift)<hdr.minsize;minshift++)
+        ;
+
+    if( heapsize == 0 )
+        heapsize = hdr.size;
+    if( minsize == 0 )
+        minsize = hdr.minsize;
+    // The base is aligned as in the trace (up to a huge page), so aligned requests behave the same
+    align = ((size_t) 1)<<(hdr.basealign < 21 ? hdr.basealign : 21);
+    if( posix_memalign((void **) &heaparea,align < sizeof(void *) ? sizeof(void *) : align,heapsize) )
+        heaparea = 0;
+    heapmetadata = malloc(BUDDY_METADATASIZE(heapsize,minsize));
+    // Live blocks are at most the leaves of the recorded heap
+    cap = 1024;
+    while( (cap < 2*(uint64_t) nrecords) && (cap < 2*(hdr.size/hdr.minsize)) )
+        cap *= 2;
+    table = malloc(cap*sizeof(entry));
+    if( !heaparea || !heapmetadata || !table ) {
+        fprintf(stderr,"Not enough memory\n");
+        return 1;
+    }
+    tablemask = cap-1;
+    for(i=0;i<(int) cap;i++)
+        table[i].key = BUDDY_TRACE_NOBLOCK;
+    if( buddy_heap_init(&heap,heaparea,heapsize,minsize,heapmetadata) ) {
+        fprintf(stderr,"Minimal size must be a power of 2 not larger than the heap\n");
+        return 1;
+    }
+    buddy_heap_setpolicy(&heap,policy);
+    buddy_slab_init(&slabheap,&heap);
+
+    printf("allocator=%s policy=%s heapsize=%lu minsize=%lu records=%ld\n",alloc->name,
+           policies[policy],(unsigned long) heapsize,(unsigned long) minsize,nrecords);
+    if( interval > 0 )
+        printf("ops,time_ns,requested,inuse,free,largest,fragmentation\n");
+    while( (n = (int) fread(records,sizeof(buddy_tracerecord),CHUNK,f)) > 0 ) {
+        for(i=0;i<n;i++) {
+            replay(&records[i],minshift);
+            ops++;
+            if( (interval > 0) && (ops%interval == 0) )
+                sample(records[i].time);
+        }
+    }
+    fclose(f);
+
+    printf("op,count,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+    report("alloc",&sa);
+    report("free",&sf);
+    printf("peak_requested=%lu peak_footprint=%lu failures=%ld max_fragmentation=%d/1000\n",
+           (unsigned long) peakrequested,(unsigned long) peakfootprint,failures,
+           maxfragmentation);
+    return 0;
+}
@@ -2,10 +2,980 @@
  *  @file  testbuddy.c
  */
 
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "buddy.h"
+#include "buddymt.h"
+#include "buddyslab.h"
+#include "buddyregions.h"
+#include "buddymmap.h"
+#include "buddyshm.h"
+#include "buddybig.h"
+#include "buddyhandle.h"
+#include "buddyarena.h"
+#include "buddytrace.h"
+
+/**
+ *  @brief  Heap instance with its own area and metadata
+ */
+///@{
+#define HEAPSIZE    8192
+#define HEAPMINSIZE 256
+static char heaparea[HEAPSIZE] __attribute__((aligned(HEAPSIZE)));
+static BUDDY_METADATA_DECLARE(heapmetadata,HEAPSIZE,HEAPMINSIZE);
+static buddy_heap heap;
+///@}
+
+/**
+ *  @brief  print statistics of a heap
+ */
+static void
+printstats(buddy_heap *h) {
+buddy_statistics st;
+
+    buddy_heap_stats(h,&st);
+    printf("free=%lu largest=%lu fragmentation=%d/1000 internal=%d/1000\n",
+           (unsigned long) st.free,(unsigned long) st.largest,st.fragmentation,st.internal);
+#ifdef BUDDY_STATS
+    printf("inuse=%lu peak=%lu failures=%lu\n",(unsigned long) st.counters.inuse,
+           (unsigned long) st.counters.peak,st.counters.failures);
+#endif
+}
+
+/**
+ *  @brief  test of the searches of bitvector.h, compared with tests of one bit at
+ *          a time for all the ranges of a vector with bits set around the ends
+ *          of the elements
+ */
+static void
+testbits(void) {
+#define BITS        200
+static BV_DECLARE(v,BITS);
+int ref[4];
+int i,s,e,errors;
+BV_TYPE w;
+
+    printf("\nSearch of bits\n");
+    bv_clearall(v,BITS);
+    for(i=0;i<BITS;i++)
+        if( (i%BV_BITS == 0) || (i%BV_BITS == BV_BITS-1) || (i%7 == 3) )
+            bv_set(v,i);
+    errors = 0;
+    for(s=0;s<=BITS;s++) {
+        for(e=s;e<=BITS;e++) {
+            ref[0] = ref[1] = ref[2] = -1;
+            ref[3] = 0;
+            for(i=s;i<e;i++) {
+                if( bv_test(v,i) ) {
+                    if( ref[0] < 0 )
+                        ref[0] = i;
+                    ref[1] = i;
+                    ref[3]++;
+                } else if( ref[2] < 0 ) {
+                    ref[2] = i;
+                }
+            }
+            errors += (bv_findnextset(v,s,e) != ref[0])+(bv_findprevset(v,s,e) != ref[1])+
+                      (bv_findnextclear(v,s,e) != ref[2])+(bv_countrange(v,s,e) != ref[3]);
+        }
+    }
+    for(i=0;i<BV_BITS;i++) {
+        w = BV_ONE<<i;
+        errors += (bv_ctz(w) != i)+(bv_clz(w) != BV_BITS-1-i)+(bv_log2(w) != i)+
+                  (bv_popcount(w-1) != i)+(bv_popcount(w|(w-1)) != i+1);
+    }
+    printf("first set=%d first clear=%d next set=%d prev set=%d count=%d errors=%d\n",
+           bv_findfirstset(v,BITS),bv_findfirstclear(v,BITS),bv_findnextset(v,4,BITS),
+           bv_findprevset(v,0,BITS),bv_countrange(v,0,BITS),errors);
+    bv_setall(v,BITS);
+    printf("full: first clear=%d next clear=%d\n",bv_findfirstclear(v,BITS),
+           bv_findnextclear(v,1,BITS));
+}
+
+/**
+ *  @brief  test of the fills and searches of bitvector.h, a word or a chunk at a
+ *          time, for ranges over several chunks. The bits outside a range must
+ *          be kept
+ */
+///@{
+#define FILLBITS    600
+static BV_DECLARE(fillvector,FILLBITS);
+
+static int
+checkfill(int s, int e) {
+bv_type v = fillvector;
+int i,errors;
+
+    errors = 0;
+    bv_clearall(v,FILLBITS);
+    bv_setrange(v,s,e);
+    for(i=0;i<FILLBITS;i++)
+        errors += (bv_test(v,i) != 0) != ((i >= s) && (i < e));
+    // The searches skip the chunks around the range
+    errors += (bv_findnextset(v,0,FILLBITS) != (s < e ? s : -1))+
+              (bv_findprevset(v,0,FILLBITS) != (s < e ? e-1 : -1))+
+              (bv_countrange(v,0,FILLBITS) != e-s);
+    bv_setall(v,FILLBITS);
+    bv_clearrange(v,s,e);
+    for(i=0;i<FILLBITS;i++)
+        errors += (bv_test(v,i) != 0) != ((i < s) || (i >= e));
+    errors += bv_findnextclear(v,0,FILLBITS) != (s < e ? s : -1);
+    return errors;
+}
+
+static void
+testfill(void) {
+int s,e,errors;
+
+#ifdef BV_SIMD
+    printf("\nFill of bits (%d bit elements, chunks of %d bytes)\n",BV_BITS,BV_CHUNKBYTES);
+#else
+    printf("\nFill of bits (%d bit elements)\n",BV_BITS);
+#endif
+    errors = 0;
+    for(s=0;s<=FILLBITS;s++) {
+        for(e=s;e<FILLBITS;e+=7)
+            errors += checkfill(s,e);
+        errors += checkfill(s,FILLBITS);
+    }
+    bv_clearall(fillvector,FILLBITS);
+    bv_toggleall(fillvector,FILLBITS);
+    printf("count=%d (after toggle) errors=%d\n",bv_countrange(fillvector,0,FILLBITS),errors);
+}
+///@}
+
+/**
+ *  @brief  test of a heap instance
+ */
+static void
+testheap(void) {
+char *p1,*p2,*p3;
+
+    printf("\nHeap instance (size = %d, minimal size = %d)\n",HEAPSIZE,HEAPMINSIZE);
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_heap_printmap(&heap);
+
+    p1 = buddy_heap_alloc(&heap,1000);
+    printf("p1=+%ld\n",(long) (p1-heaparea));
+    buddy_heap_printmap(&heap);
+    p2 = buddy_heap_alloc(&heap,200);
+    printf("p2=+%ld\n",(long) (p2-heaparea));
+    buddy_heap_printmap(&heap);
+    p3 = buddy_heap_alloc(&heap,3000);
+    printf("p3=+%ld\n",(long) (p3-heaparea));
+    buddy_heap_printmap(&heap);
+    printstats(&heap);
+
+    buddy_heap_free(&heap,p2);
+    buddy_heap_printmap(&heap);
+    buddy_heap_free(&heap,p1);
+    buddy_heap_printmap(&heap);
+    buddy_heap_free_sized(&heap,p3,3000);
+    buddy_heap_printmap(&heap);
+    printstats(&heap);
+
+    p1 = buddy_heap_alloc(&heap,200);
+    p2 = buddy_heap_alloc_aligned(&heap,200,1024);
+    printf("p1=+%ld p2=+%ld (aligned to 1024)\n",(long) (p1-heaparea),(long) (p2-heaparea));
+    buddy_heap_printmap(&heap);
+    buddy_heap_free(&heap,p1);
+
+    p2 = buddy_heap_realloc(&heap,p2,2000);
+    printf("p2=+%ld (merged with its buddies)\n",(long) (p2-heaparea));
+    buddy_heap_printmap(&heap);
+    p2 = buddy_heap_realloc(&heap,p2,300);
+    printf("p2=+%ld (shrunk in place)\n",(long) (p2-heaparea));
+    buddy_heap_printmap(&heap);
+    printf("%s\n",buddy_heap_realloc(&heap,p2,HEAPSIZE+1) ? "Error" : "No room for HEAPSIZE+1");
+    printstats(&heap);
+    buddy_heap_free(&heap,p2);
+
+    // A sized free inside a block is rejected
+    p1 = buddy_heap_alloc(&heap,4096);
+    buddy_heap_free_sized(&heap,p1+1024,4096);
+    printf("usable=%lu (after a sized free inside it)\n",
+           (unsigned long) buddy_heap_usable_size(&heap,p1));
+    buddy_heap_free_sized(&heap,p1,4096);
+}
+
+#ifdef BUDDY_LAZY
+/**
+ *  @brief  test of lazy coalescing
+ */
+static void
+testlazy(void) {
+char *p1,*p2;
+
+    printf("\nLazy coalescing\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    p1 = buddy_heap_alloc(&heap,200);
+    buddy_heap_free(&heap,p1);
+    printstats(&heap);
+    p2 = buddy_heap_alloc(&heap,200);
+    printf("p1=+%ld p2=+%ld\n",(long) (p1-heaparea),(long) (p2-heaparea));
+    buddy_heap_free(&heap,p2);
+    buddy_heap_merge(&heap);
+    printstats(&heap);
+}
+#endif
+
+#ifdef BUDDY_BLOCKED
+/**
+ *  @brief  lines
+ *
+ *  @note   returns the number of blocks (cache lines) of the nodes of h with
+ *          any bit set
+ */
+static int
+lines(buddy_heap *h) {
+const unsigned char *p = (const unsigned char *) h->nodes;
+int i,j,n,nblocks;
+
+    nblocks = BUDDY_NODESLOTS(h->mapsize)/4/BUDDY_BLOCKBYTES;
+    for(i=n=0;i<nblocks;i++) {
+        for(j=0;(j<BUDDY_BLOCKBYTES)&&(p[i*BUDDY_BLOCKBYTES+j] == 0);j++)
+            ;
+        n += j < BUDDY_BLOCKBYTES;
+    }
+    return n;
+}
+
+/**
+ *  @brief  test of the nodes cut in blocks: the path from the root to a leaf
+ *          is in one block every BUDDY_BLOCKHEIGHT levels
+ */
+static void
+testblocked(void) {
+#define BLOCKEDSIZE (1024*1024)
+#define BLOCKEDMIN  64
+static BUDDY_METADATA_DECLARE(metadata,BLOCKEDSIZE,BLOCKEDMIN);
+static char *blocks[BLOCKEDSIZE/BLOCKEDMIN];
+buddy_statistics st;
+buddy_heap h;
+char *area,*p,*q;
+int i,j,n;
+
+    printf("\nNodes in blocks of %d levels\n",BUDDY_BLOCKHEIGHT);
+    area = (char *) mmap(0,BLOCKEDSIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if( area == (char *) MAP_FAILED ) {
+        printf("mmap failed\n");
+        return;
+    }
+    buddy_heap_init(&h,area,BLOCKEDSIZE,BLOCKEDMIN,metadata);
+    printf("levels=%d aligned=%d lines=%d\n",h.leaflevel+1,
+           ((uintptr_t) h.nodes)%BUDDY_BLOCKBYTES == 0,lines(&h));
+    p = buddy_heap_alloc(&h,BLOCKEDMIN);
+    printf("p=+%ld lines=%d\n",(long) (p-area),lines(&h));
+    buddy_heap_free(&h,p);
+    q = buddy_heap_alloc(&h,BLOCKEDSIZE/2);
+    p = buddy_heap_alloc(&h,BLOCKEDMIN);
+    printf("p=+%ld lines=%d (after a half)\n",(long) (p-area),lines(&h));
+    buddy_heap_free(&h,p);
+    buddy_heap_free(&h,q);
+
+    // All the leaves, freed in another order
+    for(n=0;(blocks[n] = buddy_heap_alloc(&h,BLOCKEDMIN)) != 0;n++)
+        ;
+    printf("blocks=%d check=%d\n",n,buddy_heap_check(&h,0));
+    for(i=0;i<n;i++) {
+        j = (int) ((i*7919L)%n);
+        buddy_heap_free(&h,blocks[j]);
+    }
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(&h);
+#endif
+    buddy_heap_stats(&h,&st);
+    printf("largest=%lu lines=%d check=%d\n",(unsigned long) st.largest,lines(&h),
+           buddy_heap_check(&h,0));
+    (void) munmap(area,BLOCKEDSIZE);
+}
+#endif
+
+#ifdef BUDDY_ORDERMAP
+/**
+ *  @brief  test of the order map
+ */
+static void
+testordermap(void) {
+char *p1,*p2,*p3;
+
+    printf("\nOrder map\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    p1 = buddy_heap_alloc(&heap,3000);
+    p2 = buddy_heap_alloc(&heap,200);
+    p3 = buddy_heap_alloc(&heap,700);
+    printf("usable=%lu,%lu,%lu inside=%lu\n",(unsigned long) buddy_heap_usable_size(&heap,p1),
+           (unsigned long) buddy_heap_usable_size(&heap,p2),
+           (unsigned long) buddy_heap_usable_size(&heap,p3),
+           (unsigned long) buddy_heap_usable_size(&heap,p1+1024));
+    buddy_heap_free(&heap,p1);
+    buddy_heap_free(&heap,p2);
+    printf("usable=%lu,%lu check=%d\n",(unsigned long) buddy_heap_usable_size(&heap,p1),
+           (unsigned long) buddy_heap_usable_size(&heap,p3),buddy_heap_check(&heap,0));
+    buddy_heap_free(&heap,p3);
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(&heap);
+#endif
+    printstats(&heap);
+}
+#endif
+
+#ifdef BUDDY_CHECKED
+/**
+ *  @brief  error routine of the test of the checked mode
+ */
+static void
+printerror(void *addr, int error, void *arg) {
+    printf("error %d at +%ld\n",error,(long) ((char *) addr-(char *) arg));
+}
+
+/**
+ *  @brief  test of the checked mode
+ */
+static void
+testchecked(void) {
+char *p1,*p2,*p3;
+
+    printf("\nChecked mode\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_heap_seterror(&heap,printerror,heaparea);
+    p1 = buddy_heap_alloc(&heap,1000);
+    p2 = buddy_heap_alloc(&heap,200);
+    p3 = buddy_heap_alloc(&heap,500);
+    p1[1000] = 0;
+    buddy_heap_free(&heap,p1);
+    buddy_heap_free(&heap,p2+16);
+    buddy_heap_free(&heap,p2);
+    buddy_heap_free(&heap,p2);
+    buddy_heap_free_sized(&heap,p3,100);
+    printf("errors=%lu poison=%02X\n",heap.errors,(unsigned char) p2[0]);
+
+    // A realloc without room keeps the trailer of the block
+    p1 = buddy_heap_alloc(&heap,400);
+    p2 = buddy_heap_alloc(&heap,400);
+    printf("%s\n",buddy_heap_realloc(&heap,p1,HEAPSIZE) ? "Error" : "No room for the realloc");
+    p1[400] = 0;
+    buddy_heap_free(&heap,p1);
+    buddy_heap_free(&heap,p2);
+    printf("errors=%lu\n",heap.errors);
+}
+#endif
+
+#ifdef BUDDY_TRACE
+/**
+ *  @brief  test of the trace
+ */
+static void
+testtrace(void) {
+static char ring[BUDDY_TRACE_BUFSIZE(8)];
+buddy_tracerecord r[8];
+buddy_trace tr;
+char *p1,*p2;
+int i,n;
+
+    printf("\nTrace\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_trace_init(&tr,ring,8);
+    buddy_heap_settrace(&heap,&tr);
+    p1 = buddy_heap_alloc(&heap,200);
+    p2 = buddy_heap_alloc_aligned(&heap,1000,1024);
+    p2 = buddy_heap_realloc(&heap,p2,3000);
+    buddy_heap_free(&heap,p1);
+    buddy_heap_free(&heap,p1);              // rejected, not traced
+    buddy_heap_free_sized(&heap,p2,3000);
+    buddy_heap_free_bulk(&heap,(void **) &p2,1);
+    (void) buddy_heap_alloc(&heap,2*HEAPSIZE);
+    buddy_heap_settrace(&heap,0);
+    n = buddy_trace_read(&tr,r,8);
+    for(i=0;i<n;i++)
+        printf("op=%d size=%u block=%d old=%d align=%d\n",r[i].op,r[i].size,(int) r[i].block,
+               (int) r[i].old,r[i].align);
+
+    // Records 0xFFFFFFFE to 0x00000001, the wrap is read as any other number
+    buddy_trace_init(&tr,ring,8);
+    tr.head = tr.tail = 0xFFFFFFFE;
+    for(i=0;i<4;i++)
+        buddy_trace_record(&tr,BUDDY_TRACE_ALLOC,i,i,0,0);
+    n = buddy_trace_read(&tr,r,8);
+    printf("read=%d lost=%u size=%u,%u,%u,%u (wrap)\n",n,tr.lost,r[0].size,r[1].size,r[2].size,
+           r[3].size);
+}
+#endif
+
+/**
+ *  @brief  test of a heap whose size is not a power of 2
+ */
+static void
+testtail(void) {
+char *p1,*p2,*p3;
+
+    printf("\nHeap with size = %d\n",HEAPSIZE-3*HEAPMINSIZE);
+    buddy_heap_init(&heap,heaparea,HEAPSIZE-3*HEAPMINSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_heap_printmap(&heap);
+    printstats(&heap);
+    p1 = buddy_heap_alloc(&heap,4096);
+    p2 = buddy_heap_alloc(&heap,1024);
+    p3 = buddy_heap_alloc(&heap,2048);
+    printf("p1=+%ld p2=+%ld p3=+%ld\n",(long) (p1-heaparea),(long) (p2-heaparea),
+           (long) (p3-heaparea));
+    buddy_heap_printmap(&heap);
+    printf("%s\n",buddy_heap_alloc(&heap,1024) ? "Error" : "No room for another 1024");
+    buddy_heap_free(&heap,p1);
+    buddy_heap_free(&heap,p2);
+    buddy_heap_free(&heap,p3);
+    printstats(&heap);
+}
+
+/**
+ *  @brief  test of the search of free blocks through the summary of avail, in a
+ *          full heap with two blocks freed far apart
+ */
+static void
+testsearch(void) {
+#define SEARCHSIZE  (1024*1024)
+#define SEARCHMIN   64
+static BUDDY_METADATA_DECLARE(metadata,SEARCHSIZE,SEARCHMIN);
+static char *blocks[SEARCHSIZE/SEARCHMIN];
+buddy_heap h;
+char *area,*p1,*p2;
+int i,n;
+
+    printf("\nSearch of free blocks\n");
+    area = (char *) mmap(0,SEARCHSIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if( area == (char *) MAP_FAILED ) {
+        printf("mmap failed\n");
+        return;
+    }
+    buddy_heap_init(&h,area,SEARCHSIZE,SEARCHMIN,metadata);
+    for(n=0;(blocks[n] = buddy_heap_alloc(&h,SEARCHMIN)) != 0;n++)
+        ;
+    buddy_heap_free(&h,blocks[n-1]);
+    buddy_heap_free(&h,blocks[n/2+1]);
+    p1 = buddy_heap_alloc(&h,SEARCHMIN);
+    p2 = buddy_heap_alloc(&h,SEARCHMIN);
+    printf("blocks=%d summary=%d p1=+%ld p2=+%ld check=%d\n",n,h.nsummary,
+           (long) (p1-area),(long) (p2-area),buddy_heap_check(&h,0));
+    buddy_heap_setpolicy(&h,BUDDY_POLICY_TOPDOWN);
+    buddy_heap_free(&h,blocks[0]);
+    buddy_heap_free(&h,blocks[n/2+1]);
+    p1 = buddy_heap_alloc(&h,SEARCHMIN);
+    p2 = buddy_heap_alloc(&h,SEARCHMIN);
+    printf("p1=+%ld p2=+%ld (topdown) full=%d\n",(long) (p1-area),(long) (p2-area),
+           buddy_heap_alloc(&h,SEARCHMIN) == 0);
+    for(i=0;i<n;i++)
+        buddy_heap_free(&h,blocks[i]);
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(&h);
+#endif
+    printf("check=%d\n",buddy_heap_check(&h,0));
+    printstats(&h);
+    (void) munmap(area,SEARCHSIZE);
+}
+
+/**
+ *  @brief  test of the limit of the depth of the tree, checked before the area
+ *          and the metadata are touched
+ */
+static void
+testlimit(void) {
+static char dummy[64];
+
+    printf("\nLimit of the tree\n");
+    printf("leaves=%lu init=%d\n",(unsigned long) BUDDY_MAXLEAVES+1,
+           buddy_heap_init(&heap,dummy,BUDDY_MAXLEAVES+1,1,dummy));
+    printf("leaves=%lu init=%d\n",(unsigned long) (2*BUDDY_MAXLEAVES),
+           buddy_heap_init(&heap,dummy,2*BUDDY_MAXLEAVES,1,dummy));
+}
+
+/**
+ *  @brief  test of bulk allocation and free
+ */
+static void
+testbulk(void) {
+void *p[12];
+int n;
+
+    printf("\nBulk allocation\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    p[0] = buddy_heap_alloc(&heap,HEAPMINSIZE);
+    n = buddy_heap_alloc_bulk(&heap,500,11,p+1);
+    printf("%d blocks allocated\n",n);
+    buddy_heap_printmap(&heap);
+    buddy_heap_free_bulk(&heap,p+4,8);
+    buddy_heap_printmap(&heap);
+    buddy_heap_free_bulk(&heap,p,4);
+    buddy_heap_printmap(&heap);
+}
+
+/**
+ *  @brief  test of the release of a subtree and of a reset
+ */
+static void
+testsubtree(void) {
+char *p1,*p2,*p3;
+unsigned g;
+
+    printf("\nRelease of a subtree\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    p1 = buddy_heap_alloc(&heap,HEAPSIZE/2);
+    p2 = buddy_heap_alloc(&heap,HEAPMINSIZE);
+    p3 = buddy_heap_alloc(&heap,2*HEAPMINSIZE);
+    (void) buddy_heap_alloc(&heap,HEAPMINSIZE);
+    buddy_heap_printmap(&heap);
+    printf("%d\n",buddy_heap_free_subtree(&heap,p1+HEAPMINSIZE,HEAPMINSIZE));
+    printf("%d\n",buddy_heap_free_subtree(&heap,p2,HEAPSIZE/2));
+    buddy_heap_printmap(&heap);
+    printstats(&heap);
+#ifdef BUDDY_STATS
+    printf("frees=%lu,%lu,%lu\n",heap.counters.frees[0],heap.counters.frees[1],
+           heap.counters.frees[heap.leaflevel-1]);
+#endif
+    (void) buddy_heap_alloc(&heap,HEAPMINSIZE);
+    g = heap.generation;
+    printf("new generation=%d\n",buddy_heap_reset(&heap) != g);
+    buddy_heap_printmap(&heap);
+    printstats(&heap);
+    g = heap.generation;
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    printf("new generation=%d (after init)\n",heap.generation != g);
+    (void) p3;
+}
+
+/**
+ *  @brief  test of the placement policies
+ */
+static void
+testpolicy(void) {
+static const char *names[] = { "firstfit", "bestfit", "address", "topdown" };
+char *p[7];
+char *q;
+int i,j;
+
+    printf("\nPlacement policies\n");
+    for(i=0;i<4;i++) {
+        buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+        // Free blocks of 1 (buddy used), 2 (buddy split), 2 (buddy used) and 1 (buddy used)
+        for(j=0;j<7;j++)
+            p[j] = buddy_heap_alloc(&heap,(j >= 2) && (j <= 4) ? 2*HEAPMINSIZE : HEAPMINSIZE);
+        buddy_heap_free(&heap,p[1]);
+        buddy_heap_free(&heap,p[2]);
+        buddy_heap_free(&heap,p[4]);
+        buddy_heap_free(&heap,p[6]);
+        buddy_heap_setpolicy(&heap,i);
+        printf("%s:",names[i]);
+        for(j=0;j<3;j++) {
+            q = buddy_heap_alloc(&heap,j < 2 ? HEAPMINSIZE : 2*HEAPMINSIZE);
+            printf(" +%ld",(long) (q-heaparea)/HEAPMINSIZE);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ *  @brief  test of a persistent heap, moved to other addresses
+ */
+static void
+testimage(void) {
+static char area1[HEAPSIZE] __attribute__((aligned(HEAPSIZE)));
+static char area2[HEAPSIZE] __attribute__((aligned(HEAPSIZE)));
+static char image1[BUDDY_IMAGESIZE(HEAPSIZE,HEAPMINSIZE)] __attribute__((aligned(64)));
+static char image2[BUDDY_IMAGESIZE(HEAPSIZE,HEAPMINSIZE)] __attribute__((aligned(64)));
+buddy_heap *h;
+char *p1,*p2;
+
+    printf("\nPersistent heap\n");
+    h = buddy_heap_format(image1,area1,HEAPSIZE,HEAPMINSIZE);
+    p1 = buddy_heap_alloc(h,1000);
+    p2 = buddy_heap_alloc(h,300);
+    buddy_heap_detach(h);
+    memcpy(image2,image1,sizeof(image1));
+    memcpy(area2,area1,sizeof(area1));
+    h = buddy_heap_attach(image2,area2,0);
+    printf("size=%lu\n",(unsigned long) buddy_heap_usable_size(h,area2+(p1-area1)));
+    buddy_heap_free(h,area2+(p2-area1));
+    buddy_heap_printmap(h);
+    // Crash with a counter not updated
+    h->nfree[h->leaflevel]++;
+    printf("attach=%d\n",buddy_heap_attach(image2,area2,0) != 0);
+    h = buddy_heap_attach(image2,area2,1);
+    printf("attach=%d errors=%d\n",h != 0,buddy_heap_check(h,0));
+    buddy_heap_printmap(h);
+}
+
+/**
+ *  @brief  test of a shared heap, with two mappings of a file as two processes
+ */
+static void
+testshm(void) {
+size_t size = BUDDY_SHM_SEGMENTSIZE(HEAPSIZE,HEAPMINSIZE);
+buddy_shmheap a,b;
+buddy_shmoff o1,o2;
+char *s1,*s2;
+FILE *f;
+
+    printf("\nShared heap\n");
+    f = tmpfile();
+    if( (f == 0) || (ftruncate(fileno(f),(off_t) size) != 0) ) {
+        printf("no file\n");
+        return;
+    }
+    s1 = (char *) mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fileno(f),0);
+    s2 = (char *) mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fileno(f),0);
+    if( (s1 == (char *) MAP_FAILED) || (s2 == (char *) MAP_FAILED) ) {
+        printf("mmap failed\n");
+        return;
+    }
+    printf("format=%d\n",buddy_shm_format(&a,s1,HEAPSIZE,HEAPMINSIZE));
+    printf("attach=%d\n",buddy_shm_attach(&b,s2));
+    o1 = buddy_shm_alloc(&a,1000);
+    strcpy((char *) buddy_shm_ptr(&a,o1),"message");
+    o2 = buddy_shm_alloc(&b,300);
+    printf("o1=%lu o2=%lu text=%s\n",(unsigned long) o1,(unsigned long) o2,
+           (char *) buddy_shm_ptr(&b,o1));
+    buddy_shm_free(&b,o1);
+    buddy_shm_free_sized(&a,o2,300);
+    buddy_heap_printmap(&((buddy_image *) a.image)->heap);
+
+    // A process dies with the lock, and the next one can not rebase the heap
+    o1 = buddy_shm_alloc(&a,1000);
+    if( fork() == 0 ) {
+        pthread_mutex_lock(&a.seg->lock);
+        _exit(0);
+    }
+    (void) wait(0);
+    ((buddy_image *) b.image)->version++;
+    o2 = buddy_shm_alloc(&b,300);
+    printf("o2=%s damaged=%u repairs=%lu\n",o2 == BUDDY_SHM_NULL ? "null" : "error",
+           a.seg->damaged,a.seg->repairs);
+    ((buddy_image *) b.image)->version--;
+    o2 = buddy_shm_alloc(&b,300);
+    printf("o2=%lu damaged=%u repairs=%lu\n",(unsigned long) o2,a.seg->damaged,a.seg->repairs);
+    buddy_shm_free(&a,o1);
+    buddy_shm_free(&b,o2);
+    buddy_heap_printmap(&((buddy_image *) a.image)->heap);
+    (void) munmap(s1,size);
+    (void) munmap(s2,size);
+    fclose(f);
+}
+
+/**
+ *  @brief  test of a two level heap
+ */
+static void
+testbig(void) {
+#define BIGSIZE     (64*1024*1024)
+#define BIGCHUNK    (1024*1024)
+static char metadata[BUDDY_BIG_METADATASIZE(BIGSIZE,BIGCHUNK)] __attribute__((aligned(64)));
+buddy_bigheap bh;
+buddy_statistics st;
+char *area,*p,*q,*r;
+
+    printf("\nTwo level heap\n");
+    area = (char *) mmap(0,BIGSIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+    if( area == (char *) MAP_FAILED ) {
+        printf("mmap failed\n");
+        return;
+    }
+    printf("init=%d (chunks of 1024, no room for a record)\n",
+           buddy_big_init(&bh,area,BIGSIZE,1024,1,metadata));
+    printf("init=%d\n",buddy_big_init(&bh,area,BIGSIZE,BIGCHUNK,64,metadata));
+    p = buddy_big_alloc(&bh,100);
+    q = buddy_big_alloc(&bh,3*BIGCHUNK);
+    r = buddy_big_alloc(&bh,5000);
+    printf("p=+%ld q=+%ld r=+%ld split=%d usable=%lu,%lu,%lu\n",(long) (p-area),
+           (long) (q-area),(long) (r-area),bh.nsplit,
+           (unsigned long) buddy_big_usable_size(&bh,p),
+           (unsigned long) buddy_big_usable_size(&bh,q),
+           (unsigned long) buddy_big_usable_size(&bh,r));
+    buddy_big_free(&bh,p);
+    buddy_big_free_sized(&bh,q,3*BIGCHUNK);
+    printf("split=%d\n",bh.nsplit);
+    // Double frees and a free inside r do not drop the chunk of r
+    buddy_big_free(&bh,p);
+    buddy_big_free_sized(&bh,p,100);
+    buddy_big_free(&bh,r+64);
+    printf("split=%d usable=%lu (after bad frees)\n",bh.nsplit,
+           (unsigned long) buddy_big_usable_size(&bh,r));
+    buddy_big_free(&bh,r);
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(&bh.top);
+#endif
+    buddy_big_stats(&bh,&st);
+    printf("split=%d free=%luK\n",bh.nsplit,(unsigned long) st.free/1024);
+    (void) munmap(area,BIGSIZE);
+}
+
+/**
+ *  @brief  test of movable blocks, compacted with a handle pinned
+ */
+static void
+testhandle(void) {
+buddy_handleentry table[HEAPSIZE/HEAPMINSIZE];
+buddy_handleheap hh;
+buddy_handle h;
+int i,bad;
+
+    printf("\nMovable blocks\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_handle_init(&hh,&heap,table,HEAPSIZE/HEAPMINSIZE);
+    for(i=0;i<HEAPSIZE/HEAPMINSIZE;i++) {
+        h = buddy_handle_alloc(&hh,200);
+        *(int *) buddy_handle_ptr(&hh,h) = h;
+    }
+    for(i=0;i<HEAPSIZE/HEAPMINSIZE;i+=2)
+        buddy_handle_free(&hh,i);
+    printstats(&heap);
+    (void) buddy_handle_pin(&hh,HEAPSIZE/HEAPMINSIZE-1);
+    printf("moved=%d\n",buddy_handle_compact(&hh,0));
+    printstats(&heap);
+    buddy_handle_unpin(&hh,HEAPSIZE/HEAPMINSIZE-1);
+    printf("moved=%d\n",buddy_handle_compact(&hh,0));
+    printstats(&heap);
+    bad = 0;
+    for(i=1;i<HEAPSIZE/HEAPMINSIZE;i+=2)
+        bad += *(int *) buddy_handle_ptr(&hh,i) != i;
+    printf("bad=%d moves=%lu\n",bad,hh.moves);
+}
+
+/**
+ *  @brief  test of an arena, with blocks freed by the last object and by a reset
+ */
+static void
+testarena(void) {
+buddy_arena a;
+char *p1,*p2,*p3,*p4,*p5;
+
+    printf("\nArena\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    printf("init=%d\n",buddy_arena_init(&a,&heap,2048,0));
+    p1 = buddy_arena_alloc(&a,600);
+    p2 = buddy_arena_alloc(&a,600);
+    p3 = buddy_arena_alloc(&a,600);
+    p4 = buddy_arena_alloc(&a,600);
+    p5 = buddy_arena_alloc(&a,3000);
+    printf("p1=+%ld p2=+%ld p3=+%ld p4=+%ld p5=+%ld blocks=%lu\n",(long) (p1-heaparea),
+           (long) (p2-heaparea),(long) (p3-heaparea),(long) (p4-heaparea),
+           (long) (p5-heaparea),a.blocks);
+    buddy_arena_free(&a,p1);
+    buddy_arena_free(&a,p2);
+    buddy_arena_free(&a,p3);
+    buddy_arena_free(&a,p5);
+    printstats(&heap);
+    (void) buddy_arena_alloc(&a,100);
+    buddy_arena_reset(&a);
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(&heap);
+#endif
+    printstats(&heap);
+}
+
+/**
+ *  @brief  test of a heap in a mapped area
+ */
+static void
+testmmap(void) {
+buddy_heap *h;
+buddy_mmapheap *mh;
+char *p,*q;
+
+    printf("\nMapped heap\n");
+    h = buddy_heap_create_mmap(64*1024*1024,4096,0);
+    if( h == 0 ) {
+        printf("mmap failed\n");
+        return;
+    }
+    mh = (buddy_mmapheap *) h;
+    p = buddy_heap_alloc(h,8*1024*1024);
+    q = buddy_heap_alloc(h,100);
+    printf("resident=%luK\n",(unsigned long) buddy_mmap_resident(h,0,0)/1024);
+    memset(p,1,8*1024*1024);
+    memset(q,1,100);
+    printf("resident=%luK\n",(unsigned long) buddy_mmap_resident(h,0,0)/1024);
+    buddy_heap_free(h,p);
+    printf("resident=%luK purges=%lu\n",(unsigned long) buddy_mmap_resident(h,0,0)/1024,
+           mh->purges);
+    buddy_heap_free(h,q);
+#ifdef BUDDY_LAZY
+    buddy_heap_merge(h);
+#endif
+    printf("resident=%luK purges=%lu purged=%lluK\n",
+           (unsigned long) buddy_mmap_resident(h,0,0)/1024,mh->purges,mh->purged/1024);
+    buddy_heap_destroy_mmap(h);
+}
+
+/**
+ *  @brief  test of the size classes
+ */
+static void
+testslab(void) {
+buddy_slabheap sh;
+char *p[20];
+char *q;
+int i;
+
+    printf("\nSize classes\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_slab_init(&sh,&heap);
+    for(i=0;i<sh.nclasses;i++)
+        printf("class %d: size=%lu count=%d\n",i,(unsigned long) sh.classes[i].size,
+               sh.classes[i].count);
+    for(i=0;i<20;i++)
+        p[i] = buddy_slab_alloc(&sh,10);
+    q = buddy_slab_alloc(&sh,100);
+    printf("p[0]=+%ld p[19]=+%ld q=+%ld size=%lu\n",(long) (p[0]-heaparea),
+           (long) (p[19]-heaparea),(long) (q-heaparea),
+           (unsigned long) buddy_slab_usable_size(&sh,p[19]));
+    buddy_heap_printmap(&heap);
+    for(i=0;i<20;i++)
+        buddy_slab_free(&sh,p[i]);
+    buddy_slab_free(&sh,q);
+    buddy_heap_printmap(&heap);
+    buddy_slab_trim(&sh);
+    buddy_heap_printmap(&heap);
+}
+
+/**
+ *  @brief  test of a set of regions
+ *
+ *  @note   The area of the heap instance is divided in two regions, at nodes
+ *          0 and 1
+ */
+static void
+testregions(void) {
+static BUDDY_METADATA_DECLARE(metadata0,HEAPSIZE/2,HEAPMINSIZE);
+static BUDDY_METADATA_DECLARE(metadata1,HEAPSIZE/2,HEAPMINSIZE);
+static buddy_heap heap1;
+buddy_regionset rs;
+char *p[4];
+int i;
+
+    printf("\nRegions\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE/2,HEAPMINSIZE,metadata0);
+    buddy_heap_init(&heap1,heaparea+HEAPSIZE/2,HEAPSIZE/2,HEAPMINSIZE,metadata1);
+    buddy_regions_init(&rs);
+    buddy_regions_add(&rs,&heap,0,0);
+    buddy_regions_add(&rs,&heap1,1,0);
+    p[0] = buddy_regions_alloc(&rs,2048,1);
+    p[1] = buddy_regions_alloc(&rs,2048,1);
+    p[2] = buddy_regions_alloc(&rs,2048,1);
+    p[3] = buddy_regions_alloc(&rs,1024,0);
+    for(i=0;i<4;i++)
+        printf("p[%d]=+%ld\n",i,(long) (p[i]-heaparea));
+    buddy_heap_printmap(&heap);
+    buddy_heap_printmap(&heap1);
+    for(i=0;i<4;i++)
+        buddy_regions_free(&rs,p[i]);
+    buddy_heap_printmap(&heap);
+    buddy_heap_printmap(&heap1);
+}
+
+/**
+ *  @brief  Thread safe heap over the heap instance
+ */
+///@{
+#define NTHREADS    4
+#define NBLOCKS     8
+static buddy_mtheap mtheap;
+///@}
+
+/**
+ *  @brief  worker
+ *
+ *  @note   allocates and frees blocks, checking that no other thread writes on them
+ */
+static void *
+worker(void *arg) {
+char id = (char) (long) arg;
+char *p[NBLOCKS];
+unsigned size,j;
+int i,n;
+
+    for(n=0;n<1000;n++) {
+        for(i=0;i<NBLOCKS;i++) {
+            size = 16+(i*37+n)%200;
+            p[i] = buddy_mt_alloc(&mtheap,size);
+            if( p[i] )
+                memset(p[i],id,size);
+        }
+        for(i=0;i<NBLOCKS;i++) {
+            if( p[i] == 0 )
+                continue;
+            size = 16+(i*37+n)%200;
+            for(j=0;j<size;j++) {
+                if( p[i][j] != id ) {
+                    printf("Thread %d: block overwritten\n",id);
+                    return 0;
+                }
+            }
+            buddy_mt_free_sized(&mtheap,p[i],size);
+        }
+    }
+    return 0;
+}
+
+/**
+ *  @brief  test of the thread safe heap
+ */
+static void
+testmt(void) {
+pthread_t threads[NTHREADS];
+char *p;
+long i;
+
+    printf("\nThread safe heap (%d threads)\n",NTHREADS);
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    buddy_mt_init(&mtheap,&heap);
+    for(i=0;i<NTHREADS;i++)
+        pthread_create(&threads[i],0,worker,(void *) (i+1));
+    for(i=0;i<NTHREADS;i++)
+        pthread_join(threads[i],0);
+
+    // The blocks cached by this thread are dropped after a reset
+    buddy_mt_free_sized(&mtheap,buddy_mt_alloc(&mtheap,100),100);
+    pthread_mutex_lock(&mtheap.lock);
+    buddy_heap_reset(&heap);
+    pthread_mutex_unlock(&mtheap.lock);
+    p = buddy_mt_alloc(&mtheap,100);
+    printf("usable=%lu (after reset)\n",(unsigned long) buddy_heap_usable_size(&heap,p));
+    buddy_mt_free_sized(&mtheap,p,100);
+    buddy_mt_destroy(&mtheap);
+    // Threads return their caches when they exit
+    buddy_heap_printmap(&heap);
+}
+
+#ifdef BUDDY_ATOMIC
+/**
+ *  @brief  test of the lock free routines
+ */
+static void
+testlockfree(void) {
+char *p[3];
+int i;
+
+    printf("\nLock free allocation of minimal blocks\n");
+    buddy_heap_init(&heap,heaparea,HEAPSIZE,HEAPMINSIZE,heapmetadata);
+    // There is no available leaf yet
+    p[0] = buddy_heap_alloc_lockfree(&heap);
+    printf("p0=%p\n",p[0]);
+    p[0] = buddy_heap_alloc(&heap,HEAPMINSIZE);
+    for(i=1;i<3;i++)
+        p[i] = buddy_heap_alloc_lockfree(&heap);
+    buddy_heap_printmap(&heap);
+    for(i=0;i<3;i++)
+        buddy_heap_free_lockfree(&heap,p[i]);
+    buddy_heap_printmap(&heap);
+    // Leaves are merged before a larger allocation
+    p[0] = buddy_heap_alloc(&heap,HEAPSIZE);
+    printf("p=+%ld\n",(long) (p[0]-heaparea));
+    buddy_heap_printmap(&heap);
+}
+#endif
 
 /**
  *  @brief  test program
@@ -20,11 +990,23 @@ unsigned size;
     printf("Total size = %d (%X)\n",BUDDYTOTALSIZE,BUDDYTOTALSIZE);
     printf("Minimal size = %d (%X)\n",BUDDYMINSIZE,BUDDYMINSIZE);
 
+#ifdef BUDDY_CHECKED
+    // The checks write to the blocks, so the area of the default heap must exist
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+    if( mmap((void *) BUDDYBASE,BUDDYTOTALSIZE,PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE,-1,0) != (void *) BUDDYBASE ) {
+        printf("no area at %X\n",BUDDYBASE);
+        return 1;
+    }
+#endif
+    buddy_init();
+
     printf("\nAddresses\n");
     buddy_printaddresses();
 
     printf("\nMap\n");
-    buddy_init();
     buddy_printmap();
 
     size = 30000;
@@ -99,6 +1081,43 @@ unsigned size;
     buddy_free(f4);
     buddy_printmap();
 
+    testbits();
+    testfill();
+    testheap();
+    testtail();
+    testsearch();
+    testlimit();
+    testbulk();
+    testsubtree();
+    testpolicy();
+    testimage();
+    testmmap();
+    testbig();
+    testhandle();
+    testarena();
+    testshm();
+    testslab();
+    testregions();
+    testmt();
+#ifdef BUDDY_ATOMIC
+    testlockfree();
+#endif
+#ifdef BUDDY_LAZY
+    testlazy();
+#endif
+#ifdef BUDDY_TRACE
+    testtrace();
+#endif
+#ifdef BUDDY_BLOCKED
+    testblocked();
+#endif
+#ifdef BUDDY_ORDERMAP
+    testordermap();
+#endif
+#ifdef BUDDY_CHECKED
+    testchecked();
+#endif
+
     return 0;
 }
 
@@ -0,0 +1,113 @@
+/**
+ *  @file  testbuddycpp.cpp
+ *
+ *  @note  test of the C++ interfaces, buddy.hpp and buddypmr.hpp
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <memory_resource>
+#include <vector>
+
+#include "buddy.hpp"
+#include "buddypmr.hpp"
+
+/**
+ *  @brief  print statistics of a heap
+ */
+static void
+printstats(buddy_heap *h) {
+buddy_statistics st;
+
+    buddy_heap_stats(h,&st);
+    printf("free=%lu largest=%lu\n",(unsigned long) st.free,(unsigned long) st.largest);
+}
+
+/**
+ *  @brief  test of BuddyAllocator
+ */
+typedef buddy::BuddyAllocator<0,65536,64> Pool;
+
+// The geometry is known at compile time
+static_assert(Pool::leaflevel == 10 && Pool::levels == 11 && Pool::nodes == 2047,"geometry");
+static_assert(Pool::levelfirst(10) == 1023,"first leaf");
+static_assert(Pool::levelof(1) == 10 && Pool::levelof(64) == 10 && Pool::levelof(65) == 9,"levels");
+static_assert(Pool::levelof(300) == 7 && Pool::blocksize(300) == 512,"level of 300");
+static_assert(Pool::levelof(65536) == 0 && Pool::levelof(65537) == -1,"level of the heap");
+
+static void
+testallocator(void) {
+static Pool pool;
+char *p,*q,*r,*s;
+
+    printf("\nBuddyAllocator<0,65536,64> metadata=%lu\n",(unsigned long) pool.metadatasize);
+    p = static_cast<char *>(pool.allocate(100));
+    q = static_cast<char *>(pool.allocate<300>());
+    r = static_cast<char *>(pool.allocate(100,1024));
+    printf("usable=%lu,%lu,%lu aligned=%d owns=%d,%d\n",(unsigned long) pool.usable_size(p),
+           (unsigned long) pool.usable_size(q),(unsigned long) pool.usable_size(r),
+           reinterpret_cast<uintptr_t>(r)%1024 == 0,pool.owns(q),pool.owns(&pool+1));
+    p = static_cast<char *>(pool.reallocate(p,200));
+    printf("usable=%lu (after realloc)\n",(unsigned long) pool.usable_size(p));
+    s = static_cast<char *>(pool.allocate<4096>());
+    printf("usable=%lu (allocate<4096>)\n",(unsigned long) pool.usable_size(s));
+    pool.deallocate<4096>(s);
+    pool.deallocate(p);
+    pool.deallocate(q,300);
+    pool.deallocate(r,100);
+    printf("%s\n",pool.allocate(65537) ? "Error" : "No room for 65537");
+    printstats(pool.heap());
+}
+
+/**
+ *  @brief  test of the memory resources and of the STL allocator
+ */
+static void
+testpmr(void) {
+static Pool pool;
+buddy_mtheap mt;
+int i,sum;
+
+    printf("\nMemory resources\n");
+    {
+        buddy::buddy_memory_resource res(pool.heap());
+        std::pmr::vector<int> v(&res);
+        for(i=0;i<1000;i++)
+            v.push_back(i);
+        printf("size=%lu inheap=%d\n",(unsigned long) v.size(),pool.owns(v.data()));
+    }
+    printstats(pool.heap());
+    {
+        buddy::buddy_stl_allocator<int> a(pool.heap());
+        std::vector<int,buddy::buddy_stl_allocator<int> > v(a);
+        for(i=0,sum=0;i<1000;i++)
+            v.push_back(i);
+        for(i=0;i<1000;i++)
+            sum += v[i];
+        printf("size=%lu sum=%d inheap=%d\n",(unsigned long) v.size(),sum,pool.owns(v.data()));
+    }
+    printstats(pool.heap());
+    buddy_mt_init(&mt,pool.heap());
+    {
+        buddy::buddy_mt_memory_resource res(&mt);
+        std::pmr::vector<double> v(&res);
+        v.resize(500);
+        printf("size=%lu inheap=%d\n",(unsigned long) v.size(),pool.owns(v.data()));
+        try {
+            v.resize(65536);
+            printf("Error\n");
+        } catch( std::bad_alloc & ) {
+            printf("bad_alloc for 65536 doubles\n");
+        }
+    }
+    buddy_mt_flush(&mt);
+    buddy_mt_destroy(&mt);
+    printstats(pool.heap());
+}
+
+int
+main(void) {
+    testallocator();
+    testpmr();
+    return 0;
+}